@@ -0,0 +1,148 @@
+/**
+ * File              : arena.h
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/**
+ * Simple arena allocator - memory is taken from big
+ * blocks and freed all at once
+ * USAGE:
+ * struct arena a;
+ * arena_init(&a, 0);
+ * char *s = arena_alloc(&a, 6);
+ * memcpy(s, "Hello", 6);
+ * int *v = arena_memdup(&a, array, sizeof(array));
+ * arena_free(&a);
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+#include <stddef.h>
+
+/* default size of arena block */
+#define ARENA_BLOCK 65536
+
+/* alignment of allocated memory */
+#define ARENA_ALIGN 16
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;   // size of data
+	size_t used;   // used bytes of data
+};
+
+/* arena structure */
+struct arena {
+	struct arena_block *head;  // current block
+	size_t bsize;              // size of new blocks
+	size_t nblocks;            // number of allocated blocks
+	size_t total;              // allocated bytes
+};
+
+/* init arena - bsize is size of blocks (ARENA_BLOCK
+ * if 0) */
+static void arena_init(struct arena *a, size_t bsize);
+
+/* allocate size bytes aligned to ARENA_ALIGN - return
+ * NULL on error */
+static void *arena_alloc(struct arena *a, size_t size);
+
+/* allocate copy of memory - return NULL on error */
+static void *arena_memdup(
+		struct arena *a, const void *p, size_t size);
+
+/* allocate null-terminated copy of string - return
+ * NULL on error */
+static char *arena_strndup(
+		struct arena *a, const char *s, size_t len);
+
+/* free all memory of arena */
+static void arena_free(struct arena *a);
+
+/* IMPLIMATION */
+#include <string.h>
+#include <stdlib.h>
+
+// offset of data in block
+#define _ARENA_HDR \
+	((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arena_init(struct arena *a, size_t bsize)
+{
+	a->head    = NULL;
+	a->bsize   = bsize ? bsize : ARENA_BLOCK;
+	a->nblocks = 0;
+	a->total   = 0;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_block *b = a->head;
+	size_t bsize;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (b && b->size - b->used >= size){
+		void *p = (char *)b + _ARENA_HDR + b->used;
+		b->used += size;
+		return p;
+	}
+
+	// big allocations get their own block, so the rest
+	// of current block is not lost
+	bsize = size > a->bsize / 4 ? size : a->bsize;
+	if (bsize > (size_t)-1 - _ARENA_HDR)
+		return NULL;
+	b = (struct arena_block *)malloc(_ARENA_HDR + bsize);
+	if (!b)
+		return NULL;
+	b->size = bsize;
+	b->used = size;
+	if (bsize == size && a->head){
+		b->next = a->head->next;
+		a->head->next = b;
+	} else {
+		b->next = a->head;
+		a->head = b;
+	}
+	a->nblocks++;
+	a->total += bsize;
+	return (char *)b + _ARENA_HDR;
+}
+
+void *arena_memdup(
+		struct arena *a, const void *p, size_t size)
+{
+	void *d = arena_alloc(a, size);
+	if (d && size)
+		memcpy(d, p, size);
+	return d;
+}
+
+char *arena_strndup(
+		struct arena *a, const char *s, size_t len)
+{
+	char *d = (char *)arena_alloc(a, len + 1);
+	if (!d)
+		return NULL;
+	memcpy(d, s, len);
+	d[len] = 0;
+	return d;
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_block *b = a->head, *next;
+	while (b) {
+		next = b->next;
+		free(b);
+		b = next;
+	}
+	a->head    = NULL;
+	a->nblocks = 0;
+	a->total   = 0;
+}
+
+#endif /* ifndef ARENA_H_ */
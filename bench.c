@@ -0,0 +1,1463 @@
+/**
+ * File              : bench.c
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/* benchmarks of RTF parser internals
+ * USAGE:
+ * cc -O2 -o bench bench.c -lpthread
+ * ./bench kwd FILE [ITERATIONS]  - keyword lookup: hash table
+ *                                  against linear scan
+ * ./bench hex [MB]                - picture hex decoding of MB
+ *                                  megabytes blip
+ * ./bench utf8 [KB]               - rtf_from_utf8 of KB kilobytes
+ *                                  paragraph
+ * ./bench table [ROWS]            - table of ROWS rows: rtf_table_row
+ *                                  against table builder
+ * ./bench img [MB]                - embedding of MB megabytes image:
+ *                                  old rtf_image_to_rtf against new
+ *                                  one and writer (hex and \bin)
+ * ./bench par FILE [THREADS]     - parse of FILE by one thread
+ *                                  against parallel parse
+ * ./bench scan [MB]               - search of special chars in MB
+ *                                  megabytes of prose: byte loop
+ *                                  against ecScanRun, and parse
+ *                                  (build with -mavx2 for AVX2 or
+ *                                  -DRTF_NO_SIMD for byte loop)
+ * ./bench gen KIND MB [SEED]      - write synthetic document of
+ *                                  MB megabytes to stdout, KIND is
+ *                                  prose, table, pict, nested, kwd
+ *                                  or skip
+ * ./bench text KIND|FILE [MB]     - plain text of synthetic document
+ *                                  of MB megabytes (default 64) or
+ *                                  of FILE: full parser against
+ *                                  ecRtfText fast path
+ * ./bench info KIND|FILE [MB]     - info_cb/date_cb only parse
+ *                                  against full parse
+ * ./bench suite [MB,MB...]        - parse (ecRtfParse) synthetic
+ *                                  documents of every kind and size
+ *                                  (default 1,100 - add 1024 for
+ *                                  1 GB) and write documents with
+ *                                  rtf.h writer: MB/s, callbacks/s,
+ *                                  allocations and peak RSS of
+ *                                  every case
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* allocations of parser and writer are counted - system
+ * headers are included above, so macros change only calls
+ * of code below */
+static size_t nallocs;
+
+static void *
+count_malloc(size_t size)
+{
+	nallocs++;
+	return malloc(size);
+}
+
+static void *
+count_calloc(size_t n, size_t size)
+{
+	nallocs++;
+	return calloc(n, size);
+}
+
+static void *
+count_realloc(void *p, size_t size)
+{
+	nallocs++;
+	return realloc(p, size);
+}
+
+#define malloc  count_malloc
+#define calloc  count_calloc
+#define realloc count_realloc
+
+#include "rtfreadr.c"
+#include "rtf.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read whole file into allocated buffer - return NULL on error */
+static char *
+read_file(const char *path, size_t *len)
+{
+	char *buf;
+	long size;
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = malloc(size + 1);
+	if (buf)
+		*len = fread(buf, 1, size, fp);
+	fclose(fp);
+	return buf;
+}
+
+/* keyword lookup as it was done before rtfkwd.h */
+static int
+lookup_linear(const char *szKeyword)
+{
+	int isym;
+	for (isym = 0; isym < isymMax; isym++)
+		if (strcmp(szKeyword, rgsymRtf[isym].szKeyword) == 0)
+			return isym;
+	return -1;
+}
+
+static int
+bench_kwd(const char *path, int iterations)
+{
+	size_t len, i, n = 0, nkw = 0;
+	char (*kw)[30];
+	volatile int sink = 0;
+	double t, tlinear, thash;
+	int it;
+
+	char *buf = read_file(path, &len);
+	if (!buf){
+		printf("Can't read file: %s\n", path);
+		return 1;
+	}
+
+	// collect control words the way ecParseRtfKeyword does
+	for (i = 0; i < len; ++i)
+		if (buf[i] == '\\')
+			nkw++;
+	kw = malloc((nkw + 1) * sizeof(*kw));
+	if (!kw)
+		return 1;
+	for (i = 0; i < len; ++i) {
+		if (buf[i] != '\\' || i + 1 == len)
+			continue;
+		int l = 0;
+		if (!isalpha(buf[++i]))
+			kw[n][l++] = buf[i];
+		else
+			while (i < len && isalpha(buf[i]) && l < 29)
+				kw[n][l++] = buf[i++];
+		kw[n++][l] = 0;
+	}
+
+	// both lookups should agree
+	for (i = 0; i < n; ++i)
+		if (lookup_linear(kw[i]) != ecLookupKeyword(kw[i])){
+			printf("lookup mismatch: %s\n", kw[i]);
+			return 1;
+		}
+
+	t = now();
+	for (it = 0; it < iterations; ++it)
+		for (i = 0; i < n; ++i)
+			sink += lookup_linear(kw[i]);
+	tlinear = now() - t;
+
+	t = now();
+	for (it = 0; it < iterations; ++it)
+		for (i = 0; i < n; ++i)
+			sink += ecLookupKeyword(kw[i]);
+	thash = now() - t;
+
+	printf("keywords: %zu x %d\n", n, iterations);
+	printf("linear scan: %8.2f ns/keyword\n",
+			tlinear * 1e9 / ((double)n * iterations));
+	printf("hash table:  %8.2f ns/keyword\n",
+			thash * 1e9 / ((double)n * iterations));
+	printf("speedup:     %8.2fx\n", tlinear / thash);
+
+	free(kw);
+	free(buf);
+	return 0;
+}
+
+/* picture hex decoding as it was done before: hex chars
+ * appended one by one to string, then sscanf of every pair */
+static size_t
+hex_decode_sscanf(const char *hex, size_t len, unsigned char **data)
+{
+	struct str img;
+	size_t i, l;
+	if (str_init(&img, 4194304))
+		return 0;
+	for (i = 0; i < len; ++i)
+		if (isxdigit((unsigned char)hex[i])){
+			char c = hex[i];
+			str_append(&img, &c, 1);
+		}
+	*data = malloc(img.len / 2 + 1);
+	if (!*data)
+		return 0;
+	for (i = 0, l = 0; i + 1 < img.len;) {
+		char cur[3];
+		unsigned int val;
+		cur[0] = img.str[i++];
+		cur[1] = img.str[i++];
+		cur[2] = 0;
+		sscanf(cur, "%x", &val);
+		(*data)[l++] = (unsigned char)val;
+	}
+	free(img.str);
+	return l;
+}
+
+struct pict_check {
+	const unsigned char *data;
+	size_t len;
+	int ok;
+};
+
+static int
+pict_check_cb(void *udata, prop_t *p, PICT *pict)
+{
+	struct pict_check *c = udata;
+	c->ok = pict->len == c->len && 
+		memcmp(pict->data, c->data, c->len) == 0;
+	return 0;
+}
+
+static int
+bench_hex(int mb)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t size = (size_t)mb << 20, i, l = 0, start, len;
+	unsigned char *bin, *data;
+	char *doc;
+	double t, told, tnew;
+	prop_t prop;
+	rnotify_t no;
+	struct pict_check check = {0};
+
+	// random blip as hex lines of 128 chars
+	bin = malloc(size);
+	doc = malloc(size * 2 + size / 64 + BUFSIZ);
+	if (!bin || !doc)
+		return 1;
+	srand(1);
+	for (i = 0; i < size; ++i)
+		bin[i] = rand();
+	l = start = sprintf(doc, 
+			"{\\rtf1{\\pict\\jpegblip\\picw100\\pich100\n");
+	for (i = 0; i < size; ++i) {
+		doc[l++] = hex[bin[i] >> 4];
+		doc[l++] = hex[bin[i] & 0x0F];
+		if (i % 64 == 63)
+			doc[l++] = '\n';
+	}
+	len = l - start;
+	l += sprintf(doc + l, "}}");
+
+	t = now();
+	if (hex_decode_sscanf(doc + start, len, &data) != size ||
+			memcmp(data, bin, size)){
+		printf("sscanf decoding failed\n");
+		return 1;
+	}
+	told = now() - t;
+	free(data);
+
+	memset(&no, 0, sizeof(no));
+	check.data = bin;
+	check.len = size;
+	no.udata = &check;
+	no.pict_cb = pict_check_cb;
+	t = now();
+	if (ecRtfParseBuffer(doc, l, &prop, &no) != ecOK || !check.ok){
+		printf("parser decoding failed\n");
+		return 1;
+	}
+	tnew = now() - t;
+
+	printf("blip: %d MB (%zu bytes of hex)\n", mb, len);
+	printf("str_append+sscanf: %8.2f MB/s\n", len / told / 1e6);
+	printf("parser (table):    %8.2f MB/s\n", len / tnew / 1e6);
+	printf("speedup:           %8.2fx\n", told / tnew);
+
+	free(doc);
+	free(bin);
+	return 0;
+}
+
+/* rtf_from_utf8 as it was done before: every char is
+ * printed after the whole output (strlen instead of 
+ * overlapped sprintf) */
+static char *
+rtf_from_utf8_sprintf(const char *s)
+{
+	size_t len = strlen(s);
+	char *out = (char *)malloc(len * 6 + 1);
+	if (!out)
+		return NULL;
+	strcpy(out, "");
+
+	char *ptr = (char *)s;
+	uint32_t c32;
+	while(*ptr){
+		uint8_t c = *ptr;
+		if (c >= 224){/* 3-bytes */
+			c32  = (*ptr++ & 0xF)  << 12;
+			c32 |= (*ptr++ & 0x3F) << 6;
+			c32 |=  *ptr++ & 0x3F;
+			sprintf(out + strlen(out), "\\u%d ", c32);
+		}
+		else if (c >= 192){/* 2-bytes */
+			c32  = (*ptr++ & 0x1F) << 6;
+			c32 |=  *ptr++ & 0x3F;
+			sprintf(out + strlen(out), "\\u%d ", c32);
+		}
+		else{/* 1-byte */
+			sprintf(out + strlen(out), "%c", *ptr++);
+		}
+	}
+	strcat(out, " ");
+	return out;
+}
+
+static int
+bench_utf8(int kb)
+{
+	static const char *words[] = {
+		"The ", "quick ", "brown ", "fox ", "{jumps} ",
+		"\u043f\u0440\u0438\u0432\u0435\u0442 ", "\u043c\u0438\u0440 ",
+		"\u4e2d\u6587 ", "C:\\\\path ", "over ", "the ", "lazy ",
+		"dog. ", "\u00e9t\u00e9 ", 
+	};
+	size_t size = (size_t)kb << 10, l = 0, n = 0;
+	char *text;
+	double t, told, tnew;
+	int it, iterations = 1;
+
+	// mixed ASCII and cyrillic/CJK paragraph
+	text = malloc(size + 32);
+	if (!text)
+		return 1;
+	srand(1);
+	while (l < size) {
+		const char *w = words[rand() % (sizeof(words)/sizeof(*words))];
+		strcpy(text + l, w);
+		l += strlen(w);
+	}
+
+	t = now();
+	free(rtf_from_utf8_sprintf(text));
+	told = now() - t;
+
+	// repeat fast one to get measurable time
+	t = now();
+	do {
+		for (it = 0; it < iterations; ++it) {
+			char *out = rtf_from_utf8(text);
+			if (!out){
+				printf("rtf_from_utf8 failed\n");
+				return 1;
+			}
+			n += strlen(out);
+			free(out);
+		}
+		tnew = now() - t;
+		iterations *= 2;
+	} while (tnew < 0.2);
+	tnew /= iterations - 1;
+
+	printf("paragraph: %zu bytes of utf8 (%zu bytes of rtf)\n", 
+			l, n / (iterations - 1));
+	printf("sprintf (old): %10.2f MB/s\n", l / told / 1e6);
+	printf("rtf_from_utf8: %10.2f MB/s\n", l / tnew / 1e6);
+	printf("speedup:       %10.2fx\n", told / tnew);
+
+	free(text);
+	return 0;
+}
+
+static int
+sink_count(void *udata, const char *data, size_t len)
+{
+	*(size_t *)udata += len;
+	return 0;
+}
+
+struct table_iter {
+	size_t row, nrows;
+	char num[32];
+};
+
+static int
+table_next(void *udata, const char *colv[], size_t lens[])
+{
+	struct table_iter *it = udata;
+	if (it->row == it->nrows)
+		return 1;
+	lens[0] = sprintf(it->num, "%zu", it->row++);
+	colv[0] = it->num;
+	colv[1] = "Иванов И.И.";
+	colv[2] = "Some longer description {with braces}";
+	return 0;
+}
+
+static int
+bench_table(size_t nrows)
+{
+	static const int width[] = {1000, 3000, 5000};
+	const char *colv[3];
+	struct table_iter iter = {0, nrows};
+	size_t i, lold = 0, lnew = 0;
+	double t, told, tnew;
+	rtf_writer_t *w;
+	rtf_table_t *tbl;
+
+	// rtf_table_row: string per row, caller concatenates
+	t = now();
+	struct str doc;
+	if (str_init(&doc, BUFSIZ))
+		return 1;
+	for (i = 0; i < nrows; ++i) {
+		char *row;
+		table_next(&iter, colv, (size_t[3]){0});
+		row = rtf_table_row(3, (char **)colv);
+		if (!row || str_append(&doc, row, strlen(row)))
+			return 1;
+		free(row);
+	}
+	lold = doc.len;
+	free(doc.str);
+	told = now() - t;
+
+	// table builder into writer
+	iter.row = 0;
+	t = now();
+	w = rtf_writer_new(sink_count, &lnew);
+	tbl = rtf_table_begin(w, 3, width, RTF_BORDER_ALL);
+	if (!tbl || rtf_table_add_rows_cb(tbl, &iter, table_next))
+		return 1;
+	rtf_table_end(tbl);
+	rtf_writer_free(w);
+	tnew = now() - t;
+
+	printf("rows: %zu\n", nrows);
+	printf("rtf_table_row: %8.2f Mrows/s (%zu bytes)\n", 
+			nrows / told / 1e6, lold);
+	printf("rtf_table_t:   %8.2f Mrows/s (%zu bytes)\n", 
+			nrows / tnew / 1e6, lnew);
+	printf("speedup:       %8.2fx\n", told / tnew);
+	return 0;
+}
+
+/* rtf_image_to_rtf as it was done before: hex string
+ * allocated and appended to string of size*2 byte by byte */
+static size_t
+image_to_rtf_old(void *data, size_t size, char **rtf)
+{
+	static const char hex_str[] = "0123456789abcdef";
+	const unsigned char *bin = data;
+	struct str s;
+	char *hex;
+	size_t i;
+	if (str_init(&s, size * 2 + BUFSIZ))
+		return 0;
+	str_appendf(&s, 
+			"{\\pict\\picw0\\pich0\\picwgoal10254"
+			"\\pichgoal6000\\jpegblip\n");
+	hex = malloc(size * 2 + 1);
+	if (!hex)
+		return 0;
+	for (i = 0; i < size; ++i) {
+		hex[i * 2 + 0] = hex_str[(bin[i] >> 4) & 0x0F];
+		hex[i * 2 + 1] = hex_str[(bin[i]     ) & 0x0F];
+	}
+	for (i = 0; i < size * 2; ++i)
+		str_append(&s, hex + i, 1);
+	free(hex);
+	str_appendf(&s, "}\n");
+	*rtf = s.str;
+	return s.len;
+}
+
+static int
+bench_img(int mb)
+{
+	size_t size = (size_t)mb << 20, i, lold, lnew, lhex = 0, lbin = 0;
+	unsigned char *bin;
+	char *rold = NULL, *rnew = NULL;
+	double t, told, tnew, thex, tbin;
+	rtf_writer_t *w;
+	PICT pict = {0};
+
+	bin = malloc(size);
+	if (!bin)
+		return 1;
+	srand(1);
+	for (i = 0; i < size; ++i)
+		bin[i] = rand();
+
+	t = now();
+	lold = image_to_rtf_old(bin, size, &rold);
+	told = now() - t;
+
+	t = now();
+	lnew = rtf_image_to_rtf(bin, size, &rnew);
+	tnew = now() - t;
+	if (lold != lnew || memcmp(rold, rnew, lold)){
+		printf("rtf_image_to_rtf output differs\n");
+		return 1;
+	}
+	free(rold);
+	free(rnew);
+
+	pict.type = pict_png;
+	pict.data = bin;
+	pict.len  = size;
+	t = now();
+	w = rtf_writer_new(sink_count, &lhex);
+	rtf_writer_picture(w, &pict, 0);
+	rtf_writer_free(w);
+	thex = now() - t;
+
+	t = now();
+	w = rtf_writer_new(sink_count, &lbin);
+	rtf_writer_picture(w, &pict, 1);
+	rtf_writer_free(w);
+	tbin = now() - t;
+
+#ifdef __SSE2__
+	printf("image: %d MB, hex encoder: SSE2\n", mb);
+#else
+	printf("image: %d MB, hex encoder: scalar\n", mb);
+#endif
+	printf("rtf_image_to_rtf (old): %8.2f MB/s\n", size / told / 1e6);
+	printf("rtf_image_to_rtf:       %8.2f MB/s\n", size / tnew / 1e6);
+	printf("writer hex:             %8.2f MB/s (%zu bytes)\n", 
+			size / thex / 1e6, lhex);
+	printf("writer \\bin (no copy):  %8.2f MB/s (%zu bytes)\n", 
+			size / tbin / 1e6, lbin);
+
+	free(bin);
+	return 0;
+}
+
+struct par_count {
+	size_t nchars, ntext, nbytes;
+	unsigned long sum;
+};
+
+static int
+par_char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	struct par_count *c = udata;
+	c->nchars++;
+	c->sum = c->sum * 31 + ch + p->chp.fBold + p->pap.s;
+	return 0;
+}
+
+static int
+par_text_cb(void *udata, STREAM s, const prop_t *p,
+		const char *utf8, size_t len)
+{
+	struct par_count *c = udata;
+	size_t i;
+	c->ntext++;
+	c->nbytes += len;
+	for (i = 0; i < len; ++i)
+		c->sum = c->sum * 31 + (unsigned char)utf8[i];
+	return 0;
+}
+
+static int
+bench_par(const char *path, int nthreads)
+{
+	struct par_count serial, parallel;
+	rnotify_t no;
+	prop_t prop;
+	size_t len;
+	double t, tserial, tparallel;
+	int ec;
+
+	char *buf = read_file(path, &len);
+	if (!buf){
+		printf("Can't read file: %s\n", path);
+		return 1;
+	}
+	memset(&no, 0, sizeof(no));
+	no.char_cb = par_char_cb;
+	no.text_cb = par_text_cb;
+
+	memset(&serial, 0, sizeof(serial));
+	no.udata = &serial;
+	t = now();
+	ec = ecRtfParseBuffer(buf, len, &prop, &no);
+	tserial = now() - t;
+	if (ec != ecOK)
+		printf("serial parse error: %d\n", ec);
+
+	memset(&parallel, 0, sizeof(parallel));
+	no.udata = &parallel;
+	t = now();
+	ec = ecRtfParseBufferParallel(buf, len, &prop, &no, nthreads);
+	tparallel = now() - t;
+	if (ec != ecOK)
+		printf("parallel parse error: %d\n", ec);
+
+	if (memcmp(&serial, &parallel, sizeof(serial))){
+		printf("parallel parse differs from serial one\n");
+		return 1;
+	}
+	printf("document: %zu bytes, %zu runs, %zu chars\n",
+			len, serial.ntext, serial.nchars);
+	printf("serial:   %8.2f MB/s\n", len / tserial / 1e6);
+	printf("parallel: %8.2f MB/s (%d threads)\n", len / tparallel / 1e6,
+			nthreads > 0 ? nthreads : (int)sysconf(_SC_NPROCESSORS_ONLN));
+	printf("speedup:  %8.2fx\n", tserial / tparallel);
+
+	free(buf);
+	return 0;
+}
+
+/* search of special chars as it was done before ecScanRun */
+static const unsigned char *
+scan_bytes(const unsigned char *s, const unsigned char *end)
+{
+	while (s < end && !ecIsSpecialChar(*s))
+		s++;
+	return s;
+}
+
+static int
+bench_scan(int mb)
+{
+	static const char *words[] = {
+		"lorem ", "ipsum ", "dolor ", "sit ", "amet, ", "consectetur ",
+		"adipiscing ", "elit. ", "sed ", "do ", "eiusmod ", "tempor ",
+	};
+	struct str doc;
+	struct par_count count;
+	rnotify_t no;
+	prop_t prop;
+	const unsigned char *s, *end;
+	size_t nruns = 0, nruns2 = 0;
+	double t, tbytes, tsimd, tparse;
+	int ec, i;
+
+	// paragraphs of about 600 chars with some bold words
+	if (str_init(&doc, (size_t)mb * 1048576 + 4096))
+		return 1;
+	str_appendf(&doc, "{\\rtf1\\ansi\\deff0{\\fonttbl{\\f0 Times;}}\n");
+	srand(1);
+	while (doc.len < (size_t)mb * 1048576) {
+		str_append(&doc, "\\pard ", 6);
+		for (i = 0; i < 100; ++i) {
+			const char *w = words[rand() % 12];
+			if (rand() % 40 == 0)
+				str_appendf(&doc, "{\\b %s}", w);
+			else
+				str_append(&doc, w, strlen(w));
+		}
+		str_append(&doc, "\\par\n", 5);
+	}
+	str_append(&doc, "}", 1);
+	end = (const unsigned char *)doc.str + doc.len;
+
+	t = now();
+	for (s = (const unsigned char *)doc.str; s < end; s++, nruns++)
+		s = scan_bytes(s, end);
+	tbytes = now() - t;
+
+	t = now();
+	for (s = (const unsigned char *)doc.str; s < end; s++, nruns2++)
+		s = ecScanRun(s, end);
+	tsimd = now() - t;
+	if (nruns != nruns2){
+		printf("ecScanRun differs from byte loop\n");
+		return 1;
+	}
+
+	memset(&no, 0, sizeof(no));
+	memset(&count, 0, sizeof(count));
+	no.udata = &count;
+	no.text_cb = par_text_cb;
+	no.char_cb = par_char_cb;
+	t = now();
+	ec = ecRtfParseBuffer(doc.str, doc.len, &prop, &no);
+	tparse = now() - t;
+	if (ec != ecOK)
+		printf("parse error: %d\n", ec);
+
+#if defined(RTF_NO_SIMD)
+	printf("prose: %d MB, %zu runs, ecScanRun: byte loop\n", mb, nruns);
+#elif defined(__AVX2__)
+	printf("prose: %d MB, %zu runs, ecScanRun: AVX2\n", mb, nruns);
+#elif defined(__SSE2__)
+	printf("prose: %d MB, %zu runs, ecScanRun: SSE2\n", mb, nruns);
+#else
+	printf("prose: %d MB, %zu runs, ecScanRun: byte loop\n", mb, nruns);
+#endif
+	printf("byte loop: %8.2f MB/s\n", doc.len / tbytes / 1e6);
+	printf("ecScanRun: %8.2f MB/s\n", doc.len / tsimd / 1e6);
+	printf("speedup:   %8.2fx\n", tbytes / tsimd);
+	printf("parse:     %8.2f MB/s\n", doc.len / tparse / 1e6);
+
+	free(doc.str);
+	return 0;
+}
+
+/* synthetic document kinds */
+enum {
+	genProse,   // paragraphs of words with some bold/italic runs
+	genTable,   // tables of 4 columns
+	genPict,    // pictures of 32 KB with short captions
+	genNested,  // deeply nested groups with props in every one
+	genKwd,     // control word for every few chars
+	genSkip,    // bookmarks, index entries and \nonshppict pictures
+	genMax
+};
+
+static const char *gen_names[genMax] = {
+	"prose", "table", "pict", "nested", "kwd", "skip"
+};
+
+static const char *gen_words[] = {
+	"lorem ", "ipsum ", "dolor ", "sit ", "amet, ", "consectetur ",
+	"adipiscing ", "elit. ", "sed ", "do ", "eiusmod ", "tempor ",
+	"incididunt ", "ut ", "labore ", "et ", "dolore ", "magna ",
+	"aliqua. ", "\\u1087?\\u1088?\\u1080? ", "\\'e9t\\'e9 ", "quis ",
+	"nostrud ", "exercitation ",
+};
+#define GEN_NWORDS (sizeof(gen_words) / sizeof(*gen_words))
+
+/* xorshift - the same documents on every system */
+static unsigned
+gen_rand(unsigned *seed)
+{
+	unsigned x = *seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *seed = x;
+}
+
+static const char *
+gen_word(unsigned *seed)
+{
+	return gen_words[gen_rand(seed) % GEN_NWORDS];
+}
+
+/* write synthetic document of kind of about size bytes
+ * to fp - return non-null on error */
+static int
+gen_doc(FILE *fp, int kind, size_t size, unsigned seed)
+{
+	static const char hex[] = "0123456789abcdef";
+	struct str b;
+	size_t written = 0;
+	int i, k;
+
+	if (!seed)
+		seed = 1;
+	if (str_init(&b, 1 << 17))
+		return -1;
+	str_appendf(&b, 
+			"{\\rtf1\\ansi\\ansicpg1252\\deff0"
+			"{\\fonttbl{\\f0\\froman Times;}{\\f1\\fswiss Arial;}}\n"
+			"{\\colortbl;\\red255\\green0\\blue0;\\red0\\green0\\blue255;}\n"
+			"{\\stylesheet{\\s0\\fs24 Normal;}"
+			"{\\s1\\sbasedon0\\snext0\\b\\fs32 heading 1;}}\n"
+			"{\\info{\\title Synthetic %s}{\\author bench}}\n",
+			gen_names[kind]);
+
+	while (written + b.len < size) {
+		switch (kind) {
+			case genProse:
+				str_appendf(&b, "\\pard\\s%d ", gen_rand(&seed) % 8 ? 0 : 1);
+				for (i = 0; i < 100; ++i) {
+					const char *w = gen_word(&seed);
+					switch (gen_rand(&seed) % 40) {
+						case 0:
+							str_appendf(&b, "{\\b %s}", w);
+							break;
+						case 1:
+							str_appendf(&b, "{\\i\\cf1 %s}", w);
+							break;
+						default:
+							str_append(&b, w, strlen(w));
+					}
+				}
+				str_append(&b, "\\par\n", 5);
+				break;
+
+			case genTable:
+				str_append(&b, "\\trowd\\trgaph108", 16);
+				for (i = 1; i <= 4; ++i)
+					str_appendf(&b, "\\clbrdrt\\clbrdrb\\cellx%d", i * 2000);
+				str_append(&b, "\n", 1);
+				for (i = 0; i < 4; ++i) {
+					str_append(&b, "\\pard\\intbl ", 12);
+					for (k = gen_rand(&seed) % 6 + 1; k > 0; --k) {
+						const char *w = gen_word(&seed);
+						str_append(&b, w, strlen(w));
+					}
+					str_append(&b, "\\cell", 5);
+				}
+				str_append(&b, "\\row\n", 5);
+				break;
+
+			case genPict:
+				str_appendf(&b, "\\pard\\qc{\\pict\\pngblip\\picw640\\pich480"
+						"\\picwgoal9600\\pichgoal7200\n");
+				for (i = 0; i < 32768; ++i) {
+					unsigned c = gen_rand(&seed);
+					char h[2] = {hex[c & 15], hex[(c >> 4) & 15]};
+					str_append(&b, h, 2);
+					if (i % 64 == 63)
+						str_append(&b, "\n", 1);
+				}
+				str_appendf(&b, "}\\par\\pard Figure %u. %s\\par\n",
+						seed % 1000, gen_word(&seed));
+				break;
+
+			case genNested:
+				str_append(&b, "\\pard ", 6);
+				for (i = 0; i < 100; ++i)
+					str_appendf(&b, "{\\fs%d%s ", 16 + i % 16, 
+							i % 3 ? "" : "\\b");
+				for (i = 0; i < 100; ++i) {
+					const char *w = gen_word(&seed);
+					str_append(&b, w, strlen(w));
+					str_append(&b, "}", 1);
+				}
+				str_append(&b, "\\par\n", 5);
+				break;
+
+			case genKwd:
+				str_append(&b, "\\pard\\plain ", 12);
+				for (i = 0; i < 100; ++i)
+					str_appendf(&b, "\\b%d\\i%d\\fs%d\\cf%d\\f%d %c%c", 
+							i & 1, i >> 1 & 1, 20 + i % 8, i % 3, i % 2,
+							'a' + gen_rand(&seed) % 26, 'a' + i % 26);
+				str_append(&b, "\\par\n", 5);
+				break;
+
+			case genSkip:
+				str_appendf(&b, "\\pard{\\*\\bkmkstart b%u}", seed % 1000);
+				for (i = 0; i < 40; ++i) {
+					const char *w = gen_word(&seed);
+					str_append(&b, w, strlen(w));
+				}
+				str_appendf(&b, "{\\*\\bkmkend b%u}{\\xe {\\v %s}}"
+						"{\\nonshppict{\\pict\\wmetafile8\\picw640\\pich480\n",
+						seed % 1000, gen_word(&seed));
+				for (i = 0; i < 2048; ++i) {
+					unsigned c = gen_rand(&seed);
+					char h[2] = {hex[c & 15], hex[(c >> 4) & 15]};
+					str_append(&b, h, 2);
+					if (i % 64 == 63)
+						str_append(&b, "\n", 1);
+				}
+				str_append(&b, "}}\\par\n", 7);
+				break;
+		}
+		if (b.len > 1 << 16){
+			if (fwrite(b.str, 1, b.len, fp) != b.len){
+				free(b.str);
+				return -1;
+			}
+			written += b.len;
+			b.len = 0;
+		}
+	}
+	str_append(&b, "}\n", 2);
+	i = fwrite(b.str, 1, b.len, fp) != b.len;
+	free(b.str);
+	return i;
+}
+
+static int
+bench_gen(const char *name, int mb, unsigned seed)
+{
+	int kind;
+	for (kind = 0; kind < genMax; ++kind)
+		if (strcmp(name, gen_names[kind]) == 0)
+			return gen_doc(stdout, kind, (size_t)mb << 20, seed);
+	printf("Unknown kind: %s\n", name);
+	return 1;
+}
+
+/* synthetic document of kind name of mb megabytes or
+ * file name - return NULL on error */
+static char *
+load_doc(const char *name, int mb, size_t *len)
+{
+	char *buf;
+	int kind;
+
+	for (kind = 0; kind < genMax; ++kind)
+		if (strcmp(name, gen_names[kind]) == 0)
+			break;
+	if (kind < genMax){
+		FILE *fp = tmpfile();
+		if (!fp || gen_doc(fp, kind, (size_t)mb << 20, 1))
+			return NULL;
+		*len = ftell(fp);
+		rewind(fp);
+		buf = malloc(*len + 1);
+		if (buf && fread(buf, 1, *len, fp) != *len){
+			free(buf);
+			buf = NULL;
+		}
+		fclose(fp);
+		return buf;
+	}
+	if (!(buf = read_file(name, len)))
+		printf("Can't read file: %s\n", name);
+	return buf;
+}
+
+/* true if s is valid UTF-8 (no overlong forms,
+ * surrogates or chars above U+10FFFF) */
+static int
+utf8_valid(const char *str, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)str, *end = s + len;
+	while (s < end) {
+		unsigned c = *s++, n, min, i;
+		if (c < 0x80)
+			continue;
+		if ((c & 0xE0) == 0xC0){
+			n = 1; min = 0x80; c &= 0x1F;
+		} else if ((c & 0xF0) == 0xE0){
+			n = 2; min = 0x800; c &= 0x0F;
+		} else if ((c & 0xF8) == 0xF0){
+			n = 3; min = 0x10000; c &= 0x07;
+		} else
+			return 0;
+		if ((size_t)(end - s) < n)
+			return 0;
+		for (i = 0; i < n; ++i) {
+			if ((s[i] & 0xC0) != 0x80)
+				return 0;
+			c = c << 6 | (s[i] & 0x3F);
+		}
+		if (c < min || c > 0x10FFFF || (c >= 0xD800 && c < 0xE000))
+			return 0;
+		s += n;
+	}
+	return 1;
+}
+
+/* plain text of document collected from full parser */
+static int
+text_char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	char c = ch;
+	if (s != sMain)
+		return 0;
+	if (ch == PAR || ch == SECT || ch == ROW)
+		c = '\n';
+	else if (ch == CELL)
+		c = '\t';
+	else if (ch > 255)
+		return 0;
+	str_append(udata, &c, 1);
+	return 0;
+}
+
+static int
+text_run_cb(void *udata, STREAM s, int chp, int pap,
+		const char *utf8, size_t len)
+{
+	if (s == sMain)
+		str_append(udata, utf8, len);
+	return 0;
+}
+
+static int
+bench_text(const char *name, int mb)
+{
+	struct str full;
+	rnotify_t no;
+	prop_t prop;
+	char *buf, *text;
+	size_t len, ltext;
+	size_t nfull, nfast;
+	double t, tfull, tfast;
+	int ec;
+
+	if (!(buf = load_doc(name, mb, &len)))
+		return 1;
+	if (str_init(&full, BUFSIZ))
+		return 1;
+	memset(&no, 0, sizeof(no));
+	no.udata = &full;
+	no.char_cb = text_char_cb;
+	no.run_cb = text_run_cb;
+	nallocs = 0;
+	t = now();
+	ec = ecRtfParseBuffer(buf, len, &prop, &no);
+	tfull = now() - t;
+	nfull = nallocs;
+	if (ec != ecOK)
+		printf("full parse error: %d\n", ec);
+
+	nallocs = 0;
+	t = now();
+	ec = ecRtfText(buf, len, &text, &ltext);
+	tfast = now() - t;
+	nfast = nallocs;
+	if (ec != ecOK){
+		printf("ecRtfText error: %d\n", ec);
+		return 1;
+	}
+
+	printf("document: %zu bytes, text: %zu bytes (full parser: %zu)%s\n",
+			len, ltext, full.len, ltext == full.len &&
+			memcmp(text, full.str, ltext) == 0 ? "" : ", texts differ");
+	printf("full:      %8.2f MB/s %9zu allocs\n", len / tfull / 1e6, nfull);
+	printf("ecRtfText: %8.2f MB/s %9zu allocs\n", len / tfast / 1e6, nfast);
+	printf("speedup:   %8.2fx\n", tfull / tfast);
+	if (!utf8_valid(text, ltext))
+		printf("ecRtfText: invalid UTF-8\n");
+	if (!utf8_valid(full.str, full.len))
+		printf("full: invalid UTF-8\n");
+
+	free(text);
+	free(full.str);
+	free(buf);
+	return 0;
+}
+
+static int
+info_info_cb(void *udata, tINFO t, const char *s)
+{
+	++*(int *)udata;
+	return 0;
+}
+
+static int
+info_date_cb(void *udata, tDATE t, DATE *d)
+{
+	++*(int *)udata;
+	return 0;
+}
+
+static int
+info_char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	return 0;
+}
+
+static int
+bench_info(const char *name, int mb)
+{
+	rnotify_t no;
+	prop_t prop;
+	char *buf;
+	size_t len;
+	double t, tinfo, tfull;
+	int ninfo = 0, nfull = 0;
+
+	if (!(buf = load_doc(name, mb, &len)))
+		return 1;
+
+	// only metadata is wanted - parse stops after \info
+	memset(&no, 0, sizeof(no));
+	no.udata = &ninfo;
+	no.info_cb = info_info_cb;
+	no.date_cb = info_date_cb;
+	t = now();
+	ecRtfParseBuffer(buf, len, &prop, &no);
+	tinfo = now() - t;
+
+	no.udata = &nfull;
+	no.char_cb = info_char_cb;
+	t = now();
+	ecRtfParseBuffer(buf, len, &prop, &no);
+	tfull = now() - t;
+
+	printf("document: %zu bytes, info/date: %d (full parse: %d)\n",
+			len, ninfo, nfull);
+	printf("info only: %10.1f us\n", tinfo * 1e6);
+	printf("full:      %10.1f us\n", tfull * 1e6);
+
+	free(buf);
+	return 0;
+}
+
+/* callback counters of suite */
+struct suite_count {
+	size_t ncb;
+	size_t nbytes;
+};
+
+static int
+suite_command_cb(void *udata, const char *s, int param, char fParam)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_font_cb(void *udata, FONT *f)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_info_cb(void *udata, tINFO t, const char *s)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_style_cb(void *udata, STYLE *s)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_color_cb(void *udata, COLOR *c)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_text_cb(void *udata, STREAM s, const prop_t *p,
+		const char *utf8, size_t len)
+{
+	struct suite_count *c = udata;
+	c->ncb++;
+	c->nbytes += len;
+	return 0;
+}
+
+static int
+suite_pict_begin_cb(void *udata, prop_t *p, PICT *pict)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+static int
+suite_pict_chunk_cb(void *udata, PICT *pict, 
+		const unsigned char *data, size_t len)
+{
+	struct suite_count *c = udata;
+	c->ncb++;
+	c->nbytes += len;
+	return 0;
+}
+
+static int
+suite_pict_end_cb(void *udata, prop_t *p, PICT *pict, size_t len)
+{
+	((struct suite_count *)udata)->ncb++;
+	return 0;
+}
+
+/* generate document of kind to temporary file and parse
+ * it with ecRtfParse - with every callback, or with text
+ * callbacks only if fText (no command_cb, so skipped
+ * destinations are scanned and unwanted ones dropped) */
+static int
+suite_parse_with(int kind, int mb, int fText)
+{
+	struct suite_count count;
+	rnotify_t no;
+	prop_t prop;
+	double t, tgen, tparse;
+	size_t size;
+	FILE *fp;
+	int ec;
+
+	fp = tmpfile();
+	if (!fp)
+		return 1;
+	t = now();
+	if (gen_doc(fp, kind, (size_t)mb << 20, 1) || fflush(fp))
+		return 1;
+	tgen = now() - t;
+	size = ftell(fp);
+	rewind(fp);
+
+	memset(&no, 0, sizeof(no));
+	memset(&count, 0, sizeof(count));
+	no.udata = &count;
+	no.char_cb = suite_char_cb;
+	no.text_cb = suite_text_cb;
+	if (!fText){
+		no.command_cb = suite_command_cb;
+		no.font_cb = suite_font_cb;
+		no.info_cb = suite_info_cb;
+		no.style_cb = suite_style_cb;
+		no.color_cb = suite_color_cb;
+		no.pict_begin_cb = suite_pict_begin_cb;
+		no.pict_chunk_cb = suite_pict_chunk_cb;
+		no.pict_end_cb = suite_pict_end_cb;
+	}
+
+	nallocs = 0;
+	t = now();
+	ec = ecRtfParse(fp, &prop, &no);
+	tparse = now() - t;
+	fclose(fp);
+
+	printf("%-5s %-8s %6d %8.2f %9.2f %9.2f %9zu", fText ? "text" : "parse",
+			gen_names[kind], mb, tgen, size / tparse / 1e6, 
+			count.ncb / tparse / 1e6, nallocs);
+	if (ec != ecOK)
+		printf(" (error %d)", ec);
+	return ec != ecOK;
+}
+
+static int
+suite_parse(int kind, int mb)
+{
+	return suite_parse_with(kind, mb, 0);
+}
+
+static int
+suite_text(int kind, int mb)
+{
+	return suite_parse_with(kind, mb, 1);
+}
+
+struct suite_rows {
+	unsigned seed;
+	size_t   nrows;
+};
+
+static int
+suite_row(void *udata, const char *colv[], size_t lens[])
+{
+	struct suite_rows *r = udata;
+	int i;
+	if (!r->nrows)
+		return 1;
+	r->nrows--;
+	for (i = 0; i < 4; ++i) {
+		colv[i] = gen_word(&r->seed);
+		lens[i] = -1;
+	}
+	return 0;
+}
+
+/* write document of kind of mb megabytes with rtf.h
+ * writer to counting sink */
+static int
+suite_write(int kind, int mb)
+{
+	static const int width[] = {2000, 2000, 2000, 2000};
+	static const char *fonts[] = {"Times", "Arial"};
+	size_t size = (size_t)mb << 20, len = 0, ncalls = 0;
+	unsigned seed = 1;
+	unsigned char *pic = NULL;
+	char par[1024];
+	double t, twrite;
+	rtf_writer_t *w;
+	int err = 0, i;
+
+	if (kind == genPict){
+		pic = malloc(32768);
+		if (!pic)
+			return 1;
+		for (i = 0; i < 32768; ++i)
+			pic[i] = gen_rand(&seed);
+	}
+
+	nallocs = 0;
+	t = now();
+	w = rtf_writer_new(sink_count, &len);
+	if (!w)
+		return 1;
+	err |= rtf_writer_begin(w);
+	err |= rtf_writer_font_table(w, 2, fonts);
+	while (!err && len < size) {
+		switch (kind) {
+			case genProse:
+				{
+					// UTF-8 paragraph of words
+					size_t l = 0;
+					while (l < sizeof(par) - 32) {
+						static const char *uw[] = {
+							"lorem ", "ipsum ", "dolor ", "\xd0\xbf\xd1\x80\xd0\xb8 ",
+							"\xc3\xa9t\xc3\xa9 ", "sit ", "amet ",
+						};
+						const char *wd = uw[gen_rand(&seed) % 7];
+						memcpy(par + l, wd, strlen(wd));
+						l += strlen(wd);
+					}
+					par[l] = 0;
+					err |= rtf_writer_paragraph(w, par);
+					ncalls++;
+				}
+				break;
+			case genTable:
+				{
+					struct suite_rows rows = {seed, 1000};
+					rtf_table_t *tbl = rtf_table_begin(w, 4, width, RTF_BORDER_ALL);
+					if (!tbl)
+						return 1;
+					err |= rtf_table_add_rows_cb(tbl, &rows, suite_row);
+					err |= rtf_table_end(tbl);
+					seed = rows.seed;
+					ncalls += 1000;
+				}
+				break;
+			case genPict:
+				{
+					PICT pict;
+					memset(&pict, 0, sizeof(pict));
+					pict.type = pict_png;
+					pict.w = 640;
+					pict.h = 480;
+					pict.data = pic;
+					pict.len = 32768;
+					err |= rtf_writer_picture(w, &pict, 0);
+					ncalls++;
+				}
+				break;
+		}
+	}
+	err |= rtf_writer_end(w);
+	rtf_writer_free(w);
+	twrite = now() - t;
+	free(pic);
+
+	printf("write %-8s %6d %8s %9.2f %9.2f %9zu", 
+			gen_names[kind], mb, "-", len / twrite / 1e6,
+			ncalls / twrite / 1e6, nallocs);
+	if (err)
+		printf(" (error)");
+	return err != 0;
+}
+
+/* run every case in child process to get its own peak RSS */
+static int
+suite_case(int (*fn)(int kind, int mb), int kind, int mb)
+{
+	struct rusage ru;
+	int status, err;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		return 1;
+	if (pid == 0){
+		err = fn(kind, mb);
+		fflush(stdout);
+		_exit(err);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return 1;
+	// ru_maxrss is in kilobytes on Linux
+	printf(" %9.1f\n", ru.ru_maxrss / 1024.0);
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+static int
+bench_suite(const char *sizes)
+{
+	char *list = strdup(sizes), *tok, *save = NULL;
+	int kind, err = 0;
+
+	if (!list)
+		return 1;
+	printf("# MB/s - megabytes of RTF parsed or written per second\n");
+	printf("# Mcb/s - millions of parser callbacks (or writer calls)"
+			" per second\n");
+	printf("# text - parse with text callbacks only, without"
+			" command_cb\n");
+	printf("case  kind         MB    gen s      MB/s     Mcb/s"
+			"    allocs    RSS MB\n");
+	for (tok = strtok_r(list, ",", &save); tok; 
+			tok = strtok_r(NULL, ",", &save)) 
+	{
+		int mb = atoi(tok);
+		if (mb < 1)
+			continue;
+		for (kind = 0; kind < genMax; ++kind)
+			err |= suite_case(suite_parse, kind, mb);
+		for (kind = 0; kind < genMax; ++kind)
+			err |= suite_case(suite_text, kind, mb);
+		for (kind = 0; kind <= genPict; ++kind)
+			err |= suite_case(suite_write, kind, mb);
+	}
+	free(list);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 2 && strcmp(argv[1], "kwd") == 0)
+		return bench_kwd(argv[2], argc > 3 ? atoi(argv[3]) : 100);
+	if (argc > 1 && strcmp(argv[1], "hex") == 0)
+		return bench_hex(argc > 2 ? atoi(argv[2]) : 16);
+	if (argc > 1 && strcmp(argv[1], "utf8") == 0)
+		return bench_utf8(argc > 2 ? atoi(argv[2]) : 64);
+	if (argc > 1 && strcmp(argv[1], "table") == 0)
+		return bench_table(argc > 2 ? atol(argv[2]) : 100000);
+	if (argc > 1 && strcmp(argv[1], "img") == 0)
+		return bench_img(argc > 2 ? atoi(argv[2]) : 64);
+	if (argc > 2 && strcmp(argv[1], "par") == 0)
+		return bench_par(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+	if (argc > 1 && strcmp(argv[1], "scan") == 0)
+		return bench_scan(argc > 2 ? atoi(argv[2]) : 64);
+	if (argc > 3 && strcmp(argv[1], "gen") == 0)
+		return bench_gen(argv[2], atoi(argv[3]), 
+				argc > 4 ? strtoul(argv[4], NULL, 10) : 1);
+	if (argc > 2 && strcmp(argv[1], "text") == 0)
+		return bench_text(argv[2], argc > 3 ? atoi(argv[3]) : 64);
+	if (argc > 2 && strcmp(argv[1], "info") == 0)
+		return bench_info(argv[2], argc > 3 ? atoi(argv[3]) : 64);
+	if (argc > 1 && strcmp(argv[1], "suite") == 0)
+		return bench_suite(argc > 2 ? argv[2] : "1,100");
+
+	printf("Usage: %s kwd FILE [ITERATIONS]\n", argv[0]);
+	printf("       %s hex [MB]\n", argv[0]);
+	printf("       %s utf8 [KB]\n", argv[0]);
+	printf("       %s table [ROWS]\n", argv[0]);
+	printf("       %s img [MB]\n", argv[0]);
+	printf("       %s par FILE [THREADS]\n", argv[0]);
+	printf("       %s scan [MB]\n", argv[0]);
+	printf("       %s gen KIND MB [SEED]\n", argv[0]);
+	printf("       %s text KIND|FILE [MB]\n", argv[0]);
+	printf("       %s info KIND|FILE [MB]\n", argv[0]);
+	printf("       %s suite [MB,MB...]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,63 @@
+/**
+ * File              : mkrtfkwd.c
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/* generate rtfkwd.h - hash table of RTF keywords
+ * built from rgsymRtf of rtfreadr.c
+ * USAGE:
+ * cc -o mkrtfkwd mkrtfkwd.c && ./mkrtfkwd > rtfkwd.h
+ */
+
+#define RTF_KWD_GEN
+#include "rtfreadr.c"
+
+int main(int argc, char *argv[])
+{
+	short *table;
+	int size = 1, isym, i, probes, maxprobes = 0;
+
+	// keep table at most half full
+	while (size < isymMax * 2)
+		size <<= 1;
+
+	table = malloc(size * sizeof(short));
+	if (!table){
+		fprintf(stderr, "can't allocate memory\n");
+		return 1;
+	}
+	for (i = 0; i < size; ++i)
+		table[i] = -1;
+
+	for (isym = 0; isym < isymMax; ++isym) {
+		// keep only the first entry of duplicated keywords,
+		// as linear scan did
+		if (ecLookupKeyword(rgsymRtf[isym].szKeyword) != isym)
+			continue;
+		i = ecHashKeyword(rgsymRtf[isym].szKeyword) & (size - 1);
+		for (probes = 1; table[i] >= 0; probes++)
+			i = (i + 1) & (size - 1);
+		table[i] = isym;
+		if (probes > maxprobes)
+			maxprobes = probes;
+	}
+
+	printf("/* rtfkwd.h - generated by mkrtfkwd from rgsymRtf of rtfreadr.c\n");
+	printf(" * DO NOT EDIT - run mkrtfkwd after changing rgsymRtf\n");
+	printf(" * max probes: %d */\n\n", maxprobes);
+	printf("#ifndef RTFKWD_H\n");
+	printf("#define RTFKWD_H\n\n");
+	printf("#define RTF_KWD_NSYM      %d\n", isymMax);
+	printf("#define RTF_KWD_HASH_SIZE %d\n\n", size);
+	printf("static const short rgisymHash[RTF_KWD_HASH_SIZE] = {");
+	for (i = 0; i < size; ++i)
+		printf("%s%4d,", i % 12 ? " " : "\n\t", table[i]);
+	printf("\n};\n\n");
+	printf("#endif /* ifndef RTFKWD_H */\n");
+
+	free(table);
+	return 0;
+}
@@ -259,7 +259,7 @@ typedef struct doc_prop
 
 typedef	struct style {
 	int s;           // paragraph style
-	int ds;          // section style
+	int ds;          // section style or -1 if paragraph style
 	int sbedeon;     // based on style
 	int next;        // next style
 	char hidden;
@@ -300,6 +300,7 @@ typedef struct picture {
 								 // (the default is 100)
 	char   scaled; // Scales the picture to fit within the specified frame. Used only with \macpict
 								 // pictures
+	int    stream; // Stream of the picture (STREAM of rtfreadr.h) - set by parser
 } PICT;
 
 #endif
@@ -11,6 +11,9 @@
 #ifndef RTF_H_
 #define RTF_H_
 #include <stdio.h>
+#include <stdint.h>
+#include "str.h"
+#include "mswordtype.h"
 
 /* rtf_from_utf8
  * return string with rtf code from utf8 multibite 
@@ -19,6 +22,34 @@
 static char *
 rtf_from_utf8(const char *s);
 
+/* rtf_from_utf8_append
+ * append rtf code of utf8 multibite string to dynamic
+ * string - return non-null on error
+ * %s     - dynamic string (initialized with str_init)
+ * %utf8  - utf8 multibite string
+ * %len   - length of utf8 string in bytes
+ */
+static int
+rtf_from_utf8_append(struct str *s, const char *utf8, size_t len);
+
+/* max size of rtf code of one utf8 char - 
+ * surrogate pair \uN\'3f\uN\'3f */
+#define RTF_UTF8_MAXCHAR 24
+
+/* rtf_utf8_encode
+ * write rtf code of utf8 multibite string to buffer,
+ * stop when input ends or buffer has no room for
+ * next char - return number of bytes written
+ * %in    - pointer to utf8 string, moved past converted chars
+ * %end   - end of utf8 string
+ * %out   - output buffer
+ * %size  - size of output buffer (not less than 
+ *          RTF_UTF8_MAXCHAR to make progress)
+ */
+static size_t
+rtf_utf8_encode(
+		const char **in, const char *end, char *out, size_t size);
+
 /* rtf_table_header
  * return string with rtf code of table header
  * or NULL on error
@@ -59,145 +90,429 @@ rtf_table_row_from_string(
 static size_t rtf_image_to_rtf(
 		void *jpeg_data, size_t size, char **rtf);
 
+/* RTF writer - writes RTF document by parts into sink 
+ * through one internal buffer of RTF_WRITER_BUFSIZ bytes
+ * USAGE:
+ * rtf_writer_t *w = rtf_writer_new_file(stdout);
+ * const char *fonts[] = {"Times New Roman"};
+ * rtf_writer_begin(w);
+ * rtf_writer_font_table(w, 1, fonts);
+ * rtf_writer_paragraph(w, "Hello world!");
+ * rtf_writer_end(w);
+ * rtf_writer_free(w);
+ */
+
+#ifndef RTF_WRITER_BUFSIZ
+#define RTF_WRITER_BUFSIZ 65536
+#endif
+
+/* sink callback - get len bytes of RTF code - return
+ * non-null to stop writing */
+typedef int (*rtf_sink_t)(void *udata, const char *data, size_t len);
+
+typedef struct rtf_writer {
+	rtf_sink_t sink;
+	void *udata;
+	int   fd;
+	int   err;                      // non-null after error
+	size_t len;                     // bytes in buffer
+	char  buf[RTF_WRITER_BUFSIZ];
+} rtf_writer_t;
+
+/* rtf_writer_new
+ * return new writer to sink or NULL on error
+ * %sink  - sink callback
+ * %udata - pointer to transfer to sink
+ */
+static rtf_writer_t *
+rtf_writer_new(rtf_sink_t sink, void *udata);
+
+/* rtf_writer_new_file
+ * return new writer to opened file or NULL on error
+ */
+static rtf_writer_t *
+rtf_writer_new_file(FILE *fp);
+
+/* rtf_writer_new_fd
+ * return new writer to file descriptor or NULL on error
+ */
+static rtf_writer_t *
+rtf_writer_new_fd(int fd);
+
+/* rtf_writer_begin
+ * write document header - return non-null on error
+ */
+static int
+rtf_writer_begin(rtf_writer_t *w);
+
+/* rtf_writer_font_table
+ * write font table (after rtf_writer_begin) - return
+ * non-null on error
+ * %n     - number of fonts
+ * %fonts - array of font names (\fN is index in array)
+ */
+static int
+rtf_writer_font_table(rtf_writer_t *w, int n, const char *fonts[]);
+
+/* rtf_writer_color_table
+ * write color table (after font table) - return
+ * non-null on error
+ * %n     - number of colors
+ * %rgb   - array of colors as 0xRRGGBB (\cfN is index+1
+ *          in array, 0 is auto color)
+ */
+static int
+rtf_writer_color_table(rtf_writer_t *w, int n, const uint32_t rgb[]);
+
+/* rtf_writer_paragraph
+ * write paragraph of utf8 text - return non-null on error
+ */
+static int
+rtf_writer_paragraph(rtf_writer_t *w, const char *utf8);
+
+/* rtf_writer_text
+ * write len bytes of utf8 text (escaped) - return 
+ * non-null on error
+ */
+static int
+rtf_writer_text(rtf_writer_t *w, const char *utf8, size_t len);
+
+/* rtf_writer_raw
+ * write len bytes of RTF code as is - return non-null
+ * on error
+ */
+static int
+rtf_writer_raw(rtf_writer_t *w, const char *rtf, size_t len);
+
+/* rtf_writer_printf
+ * write fprint-like formated RTF code - return non-null
+ * on error
+ */
+static int
+rtf_writer_printf(rtf_writer_t *w, const char *fmt, ...);
+
+/* rtf_writer_table_header
+ * write table header - return non-null on error
+ * %coln   - number of columns
+ * %titles - array of columns titles
+ * %width  - array of columns width
+ */
+static int
+rtf_writer_table_header(rtf_writer_t *w, 
+		int coln, const char *titles[], int *width);
+
+/* rtf_writer_table_row
+ * write table row - return non-null on error
+ * %coln  - number of columns
+ * %colv  - columns values
+ */
+static int
+rtf_writer_table_row(rtf_writer_t *w, int coln, char *colv[]);
+
+/* rtf_writer_image
+ * write JPEG image - return non-null on error
+ * %jpeg_data  - image data in JPEG
+ * %size       - size of image data
+ */
+static int
+rtf_writer_image(rtf_writer_t *w, const void *jpeg_data, size_t size);
+
+/* rtf_writer_picture
+ * write picture from pict->data of pict->len bytes -
+ * return non-null on error
+ * %pict   - picture with type (PICT_T: png, jpg, emf, wmf,
+ *           mac, omf, dib, bitmap), size and goal size 
+ *           (size fields with 0 are not written)
+ * %binary - write data as \binN raw bytes instead of hex
+ *           (twice smaller, but not all readers support it)
+ */
+static int
+rtf_writer_picture(rtf_writer_t *w, const PICT *pict, int binary);
+
+/* rtf_writer_picture_begin
+ * start picture with hex data (pict->data is not used) -
+ * then write data by parts with rtf_writer_picture_data and
+ * close picture with rtf_writer_picture_end - return 
+ * non-null on error
+ */
+static int
+rtf_writer_picture_begin(rtf_writer_t *w, const PICT *pict);
+
+/* rtf_writer_picture_data
+ * write len bytes of picture data as hex - return 
+ * non-null on error
+ */
+static int
+rtf_writer_picture_data(rtf_writer_t *w, 
+		const void *data, size_t len);
+
+/* rtf_writer_picture_end
+ * close picture - return non-null on error
+ */
+static int
+rtf_writer_picture_end(rtf_writer_t *w);
+
+/* rtf_writer_end
+ * close document and flush buffer - return non-null 
+ * on error
+ */
+static int
+rtf_writer_end(rtf_writer_t *w);
+
+/* rtf_writer_flush
+ * send buffer to sink - return non-null on error
+ */
+static int
+rtf_writer_flush(rtf_writer_t *w);
+
+/* rtf_writer_free
+ * flush buffer and free writer - return non-null if
+ * there was error while writing
+ */
+static int
+rtf_writer_free(rtf_writer_t *w);
+
+/* RTF table builder - column definitions are written 
+ * once into row prefix, then rows are written with
+ * prefix and escaped cells straight into writer buffer
+ * USAGE:
+ * int width[] = {2000, 3000};
+ * const char *row[] = {"Name", "Value"};
+ * rtf_table_t *t = rtf_table_begin(w, 2, width, RTF_BORDER_ALL);
+ * rtf_table_add_row(t, row);
+ * rtf_table_end(t);
+ */
+
+/* cell borders */
+#define RTF_BORDER_TOP    0x01
+#define RTF_BORDER_LEFT   0x02
+#define RTF_BORDER_BOTTOM 0x04
+#define RTF_BORDER_RIGHT  0x08
+#define RTF_BORDER_ALL    0x0F
+
+typedef struct rtf_table {
+	rtf_writer_t *w;
+	int          coln;
+	struct str   prefix;  // \trowd with cells definitions
+	const char **colv;    // row for iterator
+	size_t      *lens;
+} rtf_table_t;
+
+/* row iterator callback - fill colv (and lens, if cell 
+ * is not null-terminated, else set it to -1) with next 
+ * row - return non-null when there are no more rows */
+typedef int (*rtf_table_row_cb)(
+		void *udata, const char *colv[], size_t lens[]);
+
+/* rtf_table_begin
+ * return new table builder or NULL on error
+ * %w       - writer
+ * %coln    - number of columns
+ * %width   - array of columns width
+ * %borders - RTF_BORDER_* flags of cells
+ */
+static rtf_table_t *
+rtf_table_begin(rtf_writer_t *w, 
+		int coln, const int *width, int borders);
+
+/* rtf_table_add_row
+ * write row of coln cells - return non-null on error
+ */
+static int
+rtf_table_add_row(rtf_table_t *t, const char *colv[]);
+
+/* rtf_table_add_rows
+ * write nrows rows from array of nrows*coln cells (row 
+ * by row) - return non-null on error
+ */
+static int
+rtf_table_add_rows(rtf_table_t *t, 
+		size_t nrows, const char *cells[]);
+
+/* rtf_table_add_rows_cb
+ * write rows returned by iterator callback - return 
+ * non-null on error
+ */
+static int
+rtf_table_add_rows_cb(rtf_table_t *t, 
+		void *udata, rtf_table_row_cb next);
+
+/* rtf_table_end
+ * close table and free builder - return non-null if 
+ * there was error while writing
+ */
+static int
+rtf_table_end(rtf_table_t *t);
+
 	
 /* IMPLIMATION */
 #include <string.h>
 #include <stdlib.h>
-#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#define _rtf_write _write
+#else
+#include <unistd.h>
+#define _rtf_write write
+#endif
 
-char *
-rtf_from_utf8(const char *s)
+/* write \uN with N as signed 16-bit value and \'3f as
+ * fallback char for readers without unicode */
+static char *
+_rtf_put_u(char *o, uint32_t c)
 {
-	if (!s)
-		return NULL;
-	
-	size_t len = strlen(s);
-	char *out = (char *)malloc(len * 6 + 1);
-	if (!out)
-		return NULL;
-	strcpy(out, "");
+	char d[8];
+	int n = 0;
+	int v = c < 0x8000 ? (int)c : (int)c - 0x10000;
 
-	char *ptr = (char *)s;
+	*o++ = '\\';
+	*o++ = 'u';
+	if (v < 0){
+		*o++ = '-';
+		v = -v;
+	}
+	do d[n++] = '0' + v % 10; while (v /= 10);
+	while (n)
+		*o++ = d[--n];
+	memcpy(o, "\\'3f", 4);
+	return o + 4;
+}
+
+size_t
+rtf_utf8_encode(
+		const char **in, const char *end, char *out, size_t size)
+{
+	const unsigned char *ptr = (const unsigned char *)*in;
+	const unsigned char *e   = (const unsigned char *)end;
+	char *o = out, *oend = out + size;
 	uint32_t c32;
-	while(*ptr){
-		// get char
+	int n, i;
+
+	while (ptr < e && oend - o >= RTF_UTF8_MAXCHAR){
 		uint8_t c = *ptr;
-		if (c >= 252){/* 6-bytes */
-			c32  = (*ptr++ & 0x1)  << 30;  // 0b00000001
-			c32 |= (*ptr++ & 0x3F) << 24;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 18;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 12;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 6;   // 0b00111111
-			c32 |=  *ptr++ & 0x3F;         // 0b00111111
-			sprintf(out, "%s\\u%d ", out, c32);
-		}	
-		else if (c >= 248){/* 5-bytes */
-			c32  = (*ptr++ & 0x3)  << 24;  // 0b00000011
-			c32 |= (*ptr++ & 0x3F) << 18;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 12;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 6;   // 0b00111111
-			c32 |=  *ptr++ & 0x3F;         // 0b00111111
-			sprintf(out, "%s\\u%d ", out, c32);
+		if (c < 0x80){
+			if (c == '\\' || c == '{' || c == '}'){
+				*o++ = '\\';
+				*o++ = *ptr++;
+				continue;
+			}
+			// copy run of plain ASCII at once
+			const unsigned char *run = ptr;
+			size_t room = oend - o;
+			while (ptr < e && (size_t)(ptr - run) < room &&
+					*ptr < 0x80 && 
+					*ptr != '\\' && *ptr != '{' && *ptr != '}')
+				ptr++;
+			memcpy(o, run, ptr - run);
+			o += ptr - run;
+			continue;
 		}
+
+		// get multibite char
+		if (c >= 248)
+			n = 0;
 		else if (c >= 240){/* 4-bytes */
-			c32  = (*ptr++ & 0x7)  << 18;  // 0b00000111
-			c32 |= (*ptr++ & 0x3F) << 12;  // 0b00111111
-			c32 |= (*ptr++ & 0x3F) << 6;   // 0b00111111
-			c32 |=  *ptr++ & 0x3F ;        // 0b00111111
-			sprintf(out, "%s\\u%d ", out, c32);
+			c32 = c & 0x7;
+			n = 4;
 		}
 		else if (c >= 224){/* 3-bytes */
-			c32  = (*ptr++ & 0xF)  << 12;  // 0b00001111
-			c32 |= (*ptr++ & 0x3F) << 6;   // 0b00111111
-			c32 |=  *ptr++ & 0x3F;         // 0b00111111
-			sprintf(out, "%s\\u%d ", out, c32);
+			c32 = c & 0xF;
+			n = 3;
 		}
 		else if (c >= 192){/* 2-bytes */
-			c32  = (*ptr++ & 0x1F) << 6;   // 0b00011111
-			c32 |=  *ptr++ & 0x3F;         // 0b00111111
-			sprintf(out, "%s\\u%d ", out, c32);
+			c32 = c & 0x1F;
+			n = 2;
 		}
-		else{/* 1-byte */
-			sprintf(out, "%s%c", out, *ptr++);
+		else
+			n = 0;
+		if (n > 0 && e - ptr < n)
+			n = 0;
+		for (i = 1; i < n; ++i) {
+			if ((ptr[i] & 0xC0) != 0x80){
+				n = 0;
+				break;
+			}
+			c32 = c32 << 6 | (ptr[i] & 0x3F);
 		}
-	}
-	strcat(out, " ");
-	return out;
-}
-
-struct _rtf_str{
-	char *str;   //null-terminated c string
-	int   len;   //length of string (without last null char)
-	int   size;  //allocated size
-};
-
-static int 
-_rtf_str_init(struct _rtf_str *s, size_t size)
-{
-	// allocate data
-	s->str = (char*)malloc(size);
-	if (!s->str)
-		return -1;
+		if (n == 0 || c32 > 0x10FFFF){
+			// broken sequence
+			*o++ = '?';
+			ptr++;
+			continue;
+		}
+		ptr += n;
 
-	// set dafaults
-	s->str[0]  = 0;
-	s->len     = 0;
-	s->size    = size;
+		if (c32 > 0xFFFF){
+			// surrogate pair
+			c32 -= 0x10000;
+			o = _rtf_put_u(o, 0xD800 | c32 >> 10);
+			o = _rtf_put_u(o, 0xDC00 | (c32 & 0x3FF));
+		} else
+			o = _rtf_put_u(o, c32);
+	}
 
-	return 0;
+	*in = (const char *)ptr;
+	return o - out;
 }
 
-static int _rtf_str_realloc(
-		struct _rtf_str *s, int new_size)
+int
+rtf_from_utf8_append(struct str *s, const char *utf8, size_t len)
 {
-	while (s->size < new_size){
-		// do realloc
-		void *p = realloc(s->str, s->size + BUFSIZ);
-		if (!p)
+	const char *end = utf8 + len;
+	while (utf8 < end){
+		// plain ASCII is copied as is, so reserve whole 
+		// length and room for escapes
+		if (str_reserve(s, s->len + (end - utf8) + 
+					RTF_UTF8_MAXCHAR + 1))
 			return -1;
-		s->str = (char*)p;
-		s->size += BUFSIZ;
+		s->len += rtf_utf8_encode(
+				&utf8, end, s->str + s->len, s->size - s->len - 1);
 	}
+	s->str[s->len] = 0;
 	return 0;
 }
 
-static void _rtf_str_append(
-		struct _rtf_str *s, const char *str, int len)
+char *
+rtf_from_utf8(const char *s)
 {
-	if (!str || len < 1)
-		return;
+	struct str out;
+	size_t len;
 
-	int new_size, i;
+	if (!s)
+		return NULL;
 	
-	new_size = s->len + len + 1;
-	// realloc if not enough size
-	if (_rtf_str_realloc(s, new_size))
-		return;
-
-	// append string
-	for (i = 0; i < len; ++i)
-		s->str[s->len++] = str[i];
-  
-	s->str[s->len] = 0;
-}
+	len = strlen(s);
+	if (str_init(&out, len + len / 4 + 2))
+		return NULL;
 
-#define _rtf_str_appendf(s, ...)\
-	({char str[BUFSIZ];sprintf(str, __VA_ARGS__);\
-			_rtf_str_append(s, str, strlen(str));});
+	if (rtf_from_utf8_append(&out, s, len) ||
+			str_append(&out, " ", 1))
+	{
+		free(out.str);
+		return NULL;
+	}
+	return out.str;
+}
 
 char *
 rtf_table_header(
 		int coln, const char *titles[], int *width)
 {
-	int i, w=0;
-	struct _rtf_str s;
-	_rtf_str_init(&s, BUFSIZ);
+	int i, w=0, err;
+	struct str s;
+	if (str_init(&s, BUFSIZ))
+		return NULL;
 	
-	_rtf_str_appendf(&s, 
+	err = str_appendf(&s, 
 			  "\\pard\\par\\trowd\n");
 	for (i = 0; i < coln; ++i) {
 		w += width[i];
-		_rtf_str_appendf(&s, 
+		err |= str_appendf(&s, 
 				"\\clbrdrt\\brdrs"
 				"\\clbrdrl\\brdrs"
 				"\\clbrdrb\\brdrs"
@@ -206,13 +521,16 @@ rtf_table_header(
 				w);
 	}
 	for (i = 0; i < coln; ++i) {
-		char *title = rtf_from_utf8(titles[i]);
-		_rtf_str_appendf(&s, 
-				"\\intbl %s \\cell\n", 
-				title);
-		free(title);
+		err |= str_append(&s, "\\intbl ", 7);
+		if (titles[i])
+			err |= rtf_from_utf8_append(&s, titles[i], strlen(titles[i]));
+		err |= str_append(&s, "  \\cell\n", 8);
 	}
 
+	if (err){
+		free(s.str);
+		return NULL;
+	}
 	return s.str;
 }
 
@@ -220,22 +538,28 @@ char *
 rtf_table_row(
 		int coln, char *colv[])
 {
-	int i;
-	struct _rtf_str s;
-	if (_rtf_str_init(&s, BUFSIZ))
+	int i, err;
+	struct str s;
+	if (str_init(&s, BUFSIZ))
 		return NULL;
 
-	_rtf_str_appendf(&s, 
+	err = str_appendf(&s, 
 				"\\trowd\n");
 	
-	for (i = 0; i < coln; ++i)
-		_rtf_str_appendf(&s, 
-				"\\intbl %s \\cell\n",
-				rtf_from_utf8(colv[i]));
+	for (i = 0; i < coln; ++i) {
+		err |= str_append(&s, "\\intbl ", 7);
+		if (colv[i])
+			err |= rtf_from_utf8_append(&s, colv[i], strlen(colv[i]));
+		err |= str_append(&s, "  \\cell\n", 8);
+	}
 	
-	_rtf_str_appendf(&s, 
+	err |= str_appendf(&s, 
 				"\\row\n");
 	
+	if (err){
+		free(s.str);
+		return NULL;
+	}
 	return s.str;
 }
 
@@ -243,18 +567,20 @@ char *
 rtf_table_row_from_string(
 		const char *colv, const char *delim)
 {
-	int i;
-	struct _rtf_str s;
-	if (_rtf_str_init(&s, BUFSIZ))
+	int i, err;
+	struct str s;
+	if (str_init(&s, BUFSIZ))
 		return NULL;
 
-	_rtf_str_appendf(&s, 
+	err = str_appendf(&s, 
 				"\\trowd\n");
 	
 	// do safe strtok
 	char *str = strdup(colv);
-	if (str == NULL)
+	if (str == NULL){
+		free(s.str);
 		return NULL;
+	}
 
 	// loop through the string to extract 
 	// tokens
@@ -262,67 +588,82 @@ rtf_table_row_from_string(
 	for(t=strtok(str, delim), i=0; 
 			t; 
 			t=strtok(NULL, delim), ++i) 
-		_rtf_str_appendf(&s, 
-				"\\intbl %s \\cell\n",
-				rtf_from_utf8(t));
+	{
+		err |= str_append(&s, "\\intbl ", 7);
+		err |= rtf_from_utf8_append(&s, t, strlen(t));
+		err |= str_append(&s, "  \\cell\n", 8);
+	}
 	
-	_rtf_str_appendf(&s, 
+	err |= str_appendf(&s, 
 				"\\row\n");
 	
 	free(str);
+	if (err){
+		free(s.str);
+		return NULL;
+	}
 	return s.str;
 }
 
-static unsigned char * _rtf_bin_to_strhex(
-		const unsigned char *bin,
-		unsigned int binsz,
-		unsigned char **result)
+/* write hex of n bytes to out (2*n chars) */
+static void
+_rtf_hex_encode(char *out, const unsigned char *in, size_t n)
 {
-	unsigned char hex_str[] = "0123456789abcdef";
-	unsigned int  i;
+	static const char hex_str[] = "0123456789abcdef";
+	size_t i = 0;
 
-	if (!binsz)
-		return NULL;
-	
-	if (!(*result = 
-				(unsigned char *)malloc(binsz * 2 + 1)))
-		return NULL;
-
-	(*result)[binsz * 2] = 0;
-
-	for (i = 0; i < binsz; ++i)
-	{
-		(*result)[i * 2 + 0] = hex_str[(bin[i] >> 4) & 0x0F];
-		(*result)[i * 2 + 1] = hex_str[(bin[i]     ) & 0x0F];
+#ifdef __SSE2__
+	// 16 bytes to 32 hex chars at once
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i c0   = _mm_set1_epi8('0');
+	const __m128i ca   = _mm_set1_epi8('a' - '0' - 10);
+	for (; i + 16 <= n; i += 16) {
+		__m128i v  = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i lo = _mm_and_si128(v, mask);
+		hi = _mm_add_epi8(_mm_add_epi8(hi, c0), 
+				_mm_and_si128(_mm_cmpgt_epi8(hi, nine), ca));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, c0), 
+				_mm_and_si128(_mm_cmpgt_epi8(lo, nine), ca));
+		_mm_storeu_si128((__m128i *)(out + i * 2), 
+				_mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + i * 2 + 16), 
+				_mm_unpackhi_epi8(hi, lo));
 	}
+#endif
 
-	return (*result);
+	for (; i < n; ++i) {
+		out[i * 2 + 0] = hex_str[in[i] >> 4];
+		out[i * 2 + 1] = hex_str[in[i] & 0x0F];
+	}
 }
 
 /* convert image to RTF string */
 size_t rtf_image_to_rtf(
 		void *jpeg_data, size_t size, char **rtf)
 {
-	struct _rtf_str s;
-	if (_rtf_str_init(&s, size * 2 + BUFSIZ))
+	int err;
+	struct str s;
+	if (str_init(&s, size * 2 + BUFSIZ))
 		return 0;
 
 	// append image header to rtf
-	_rtf_str_appendf(&s, 
+	err = str_appendf(&s, 
 			"{\\pict\\picw0\\pich0\\picwgoal10254"
 			"\\pichgoal6000\\jpegblip\n");
 	
-	// append image data to rtf
-	unsigned char *str;
-	_rtf_bin_to_strhex(
-		(unsigned char*)(jpeg_data),
-		size, &str);
-	_rtf_str_append(
-			&s, (char*)str, size*2);
-	free(str);
+	// append image data to rtf - hex right into string
+	_rtf_hex_encode(s.str + s.len, 
+			(const unsigned char *)jpeg_data, size);
+	s.len += size * 2;
 	
 	// append image close to rtf
-	_rtf_str_appendf(&s, "}\n");
+	err |= str_appendf(&s, "}\n");
+	if (err){
+		free(s.str);
+		return 0;
+	}
 
 	if (rtf)
 		*rtf = s.str;
@@ -332,4 +673,487 @@ size_t rtf_image_to_rtf(
 	return s.len;
 }
 
+static int
+_rtf_sink_file(void *udata, const char *data, size_t len)
+{
+	return fwrite(data, 1, len, (FILE *)udata) != len;
+}
+
+static int
+_rtf_sink_fd(void *udata, const char *data, size_t len)
+{
+	rtf_writer_t *w = (rtf_writer_t *)udata;
+	while (len > 0){
+		ssize_t n = _rtf_write(w->fd, data, len);
+		if (n < 0){
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += n;
+		len  -= n;
+	}
+	return 0;
+}
+
+rtf_writer_t *
+rtf_writer_new(rtf_sink_t sink, void *udata)
+{
+	rtf_writer_t *w;
+	if (!sink)
+		return NULL;
+
+	w = (rtf_writer_t *)malloc(sizeof(rtf_writer_t));
+	if (!w)
+		return NULL;
+
+	w->sink  = sink;
+	w->udata = udata;
+	w->fd    = -1;
+	w->err   = 0;
+	w->len   = 0;
+	return w;
+}
+
+rtf_writer_t *
+rtf_writer_new_file(FILE *fp)
+{
+	if (!fp)
+		return NULL;
+	return rtf_writer_new(_rtf_sink_file, fp);
+}
+
+rtf_writer_t *
+rtf_writer_new_fd(int fd)
+{
+	rtf_writer_t *w;
+	if (fd < 0)
+		return NULL;
+	w = rtf_writer_new(_rtf_sink_fd, NULL);
+	if (w){
+		w->udata = w;
+		w->fd    = fd;
+	}
+	return w;
+}
+
+int
+rtf_writer_flush(rtf_writer_t *w)
+{
+	if (w->err)
+		return w->err;
+	if (w->len > 0 && w->sink(w->udata, w->buf, w->len))
+		w->err = -1;
+	w->len = 0;
+	return w->err;
+}
+
+int
+rtf_writer_raw(rtf_writer_t *w, const char *rtf, size_t len)
+{
+	if (w->err)
+		return w->err;
+
+	// big chunk goes to sink as is
+	if (len >= RTF_WRITER_BUFSIZ){
+		if (rtf_writer_flush(w))
+			return w->err;
+		if (w->sink(w->udata, rtf, len))
+			w->err = -1;
+		return w->err;
+	}
+
+	if (RTF_WRITER_BUFSIZ - w->len < len && rtf_writer_flush(w))
+		return w->err;
+	memcpy(w->buf + w->len, rtf, len);
+	w->len += len;
+	return 0;
+}
+
+int
+rtf_writer_printf(rtf_writer_t *w, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+	
+	if (w->err)
+		return w->err;
+
+	// try to print into buffer
+	va_start(args, fmt);
+	len = vsnprintf(w->buf + w->len, 
+			RTF_WRITER_BUFSIZ - w->len, fmt, args);
+	va_end(args);
+	if (len < 0)
+		return w->err = -1;
+	if ((size_t)len < RTF_WRITER_BUFSIZ - w->len){
+		w->len += len;
+		return 0;
+	}
+
+	// not enough room - flush and print again
+	if (rtf_writer_flush(w))
+		return w->err;
+	if (len < RTF_WRITER_BUFSIZ){
+		va_start(args, fmt);
+		vsnprintf(w->buf, RTF_WRITER_BUFSIZ, fmt, args);
+		va_end(args);
+		w->len = len;
+		return 0;
+	}
+	
+	// too long for buffer
+	char *str = (char *)malloc(len + 1);
+	if (!str)
+		return w->err = -1;
+	va_start(args, fmt);
+	vsnprintf(str, len + 1, fmt, args);
+	va_end(args);
+	rtf_writer_raw(w, str, len);
+	free(str);
+	return w->err;
+}
+
+int
+rtf_writer_text(rtf_writer_t *w, const char *utf8, size_t len)
+{
+	const char *end = utf8 + len;
+	if (w->err)
+		return w->err;
+	while (utf8 < end){
+		if (RTF_WRITER_BUFSIZ - w->len < RTF_UTF8_MAXCHAR && 
+				rtf_writer_flush(w))
+			return w->err;
+		w->len += rtf_utf8_encode(
+				&utf8, end, w->buf + w->len, RTF_WRITER_BUFSIZ - w->len);
+	}
+	return 0;
+}
+
+int
+rtf_writer_begin(rtf_writer_t *w)
+{
+	return rtf_writer_printf(w, 
+			"{\\rtf1\\ansi\\deff0\\uc1\n");
+}
+
+int
+rtf_writer_font_table(rtf_writer_t *w, int n, const char *fonts[])
+{
+	int i;
+	rtf_writer_printf(w, "{\\fonttbl\n");
+	for (i = 0; i < n; ++i) {
+		rtf_writer_printf(w, "{\\f%d ", i);
+		if (fonts[i])
+			rtf_writer_text(w, fonts[i], strlen(fonts[i]));
+		rtf_writer_printf(w, ";}\n");
+	}
+	return rtf_writer_printf(w, "}\n");
+}
+
+int
+rtf_writer_color_table(rtf_writer_t *w, int n, const uint32_t rgb[])
+{
+	int i;
+	// first color is auto
+	rtf_writer_printf(w, "{\\colortbl;");
+	for (i = 0; i < n; ++i)
+		rtf_writer_printf(w, "\\red%d\\green%d\\blue%d;", 
+				rgb[i] >> 16 & 0xFF, rgb[i] >> 8 & 0xFF, rgb[i] & 0xFF);
+	return rtf_writer_printf(w, "}\n");
+}
+
+int
+rtf_writer_paragraph(rtf_writer_t *w, const char *utf8)
+{
+	rtf_writer_printf(w, "\\pard ");
+	if (utf8)
+		rtf_writer_text(w, utf8, strlen(utf8));
+	return rtf_writer_printf(w, "\\par\n");
+}
+
+int
+rtf_writer_table_header(rtf_writer_t *w,
+		int coln, const char *titles[], int *width)
+{
+	int i, wd=0;
+	
+	rtf_writer_printf(w, 
+			  "\\pard\\par\\trowd\n");
+	for (i = 0; i < coln; ++i) {
+		wd += width[i];
+		rtf_writer_printf(w, 
+				"\\clbrdrt\\brdrs"
+				"\\clbrdrl\\brdrs"
+				"\\clbrdrb\\brdrs"
+				"\\clbrdrr\\brdrs\n"
+				"\\cellx%d\n", 
+				wd);
+	}
+	for (i = 0; i < coln; ++i) {
+		rtf_writer_printf(w, "\\intbl ");
+		if (titles[i])
+			rtf_writer_text(w, titles[i], strlen(titles[i]));
+		rtf_writer_printf(w, "  \\cell\n");
+	}
+	return w->err;
+}
+
+int
+rtf_writer_table_row(rtf_writer_t *w, int coln, char *colv[])
+{
+	int i;
+	rtf_writer_printf(w, 
+				"\\trowd\n");
+	for (i = 0; i < coln; ++i) {
+		rtf_writer_printf(w, "\\intbl ");
+		if (colv[i])
+			rtf_writer_text(w, colv[i], strlen(colv[i]));
+		rtf_writer_printf(w, "  \\cell\n");
+	}
+	return rtf_writer_printf(w, 
+				"\\row\n");
+}
+
+int
+rtf_writer_image(rtf_writer_t *w, const void *jpeg_data, size_t size)
+{
+	// append image header to rtf
+	rtf_writer_printf(w, 
+			"{\\pict\\picw0\\pich0\\picwgoal10254"
+			"\\pichgoal6000\\jpegblip\n");
+	rtf_writer_picture_data(w, jpeg_data, size);
+	return rtf_writer_picture_end(w);
+}
+
+static int
+_rtf_writer_picture_header(rtf_writer_t *w, const PICT *pict)
+{
+	rtf_writer_printf(w, "{\\pict");
+	switch (pict->type) {
+		case pict_emf:
+			rtf_writer_printf(w, "\\emfblip");
+			break;
+		case pict_png:
+			rtf_writer_printf(w, "\\pngblip");
+			break;
+		case pict_jpg:
+			rtf_writer_printf(w, "\\jpegblip");
+			break;
+		case pict_mac:
+			rtf_writer_printf(w, "\\macpict");
+			break;
+		case pict_wmf:
+			rtf_writer_printf(w, "\\wmetafile%d", 
+					pict->type_n ? pict->type_n : 8);
+			break;
+		case pict_omf:
+			rtf_writer_printf(w, "\\pmmetafile%d", pict->type_n);
+			break;
+		case pict_ibitmap:
+			rtf_writer_printf(w, "\\dibitmap%d", pict->type_n);
+			break;
+		case pict_dbitmap:
+			rtf_writer_printf(w, "\\wbitmap%d", pict->type_n);
+			break;
+	}
+	if (pict->w)
+		rtf_writer_printf(w, "\\picw%ld", pict->w);
+	if (pict->h)
+		rtf_writer_printf(w, "\\pich%ld", pict->h);
+	if (pict->goalw)
+		rtf_writer_printf(w, "\\picwgoal%ld", pict->goalw);
+	if (pict->goalh)
+		rtf_writer_printf(w, "\\pichgoal%ld", pict->goalh);
+	if (pict->scalex)
+		rtf_writer_printf(w, "\\picscalex%d", pict->scalex);
+	if (pict->scaley)
+		rtf_writer_printf(w, "\\picscaley%d", pict->scaley);
+	return w->err;
+}
+
+int
+rtf_writer_picture_begin(rtf_writer_t *w, const PICT *pict)
+{
+	_rtf_writer_picture_header(w, pict);
+	return rtf_writer_printf(w, "\n");
+}
+
+int
+rtf_writer_picture_data(rtf_writer_t *w, 
+		const void *data, size_t len)
+{
+	const unsigned char *bin = (const unsigned char *)data;
+	size_t n;
+
+	// hex straight into buffer
+	while (len > 0 && !w->err){
+		n = (RTF_WRITER_BUFSIZ - w->len) / 2;
+		if (n < 16){
+			rtf_writer_flush(w);
+			continue;
+		}
+		if (n > len)
+			n = len;
+		_rtf_hex_encode(w->buf + w->len, bin, n);
+		w->len += n * 2;
+		bin += n;
+		len -= n;
+	}
+	return w->err;
+}
+
+int
+rtf_writer_picture_end(rtf_writer_t *w)
+{
+	return rtf_writer_printf(w, "}\n");
+}
+
+int
+rtf_writer_picture(rtf_writer_t *w, const PICT *pict, int binary)
+{
+	if (!binary){
+		rtf_writer_picture_begin(w, pict);
+		rtf_writer_picture_data(w, pict->data, pict->len);
+		return rtf_writer_picture_end(w);
+	}
+
+	_rtf_writer_picture_header(w, pict);
+	rtf_writer_printf(w, "\\bin%d ", pict->len);
+	rtf_writer_raw(w, (const char *)pict->data, pict->len);
+	return rtf_writer_picture_end(w);
+}
+
+int
+rtf_writer_end(rtf_writer_t *w)
+{
+	rtf_writer_printf(w, "}\n");
+	return rtf_writer_flush(w);
+}
+
+int
+rtf_writer_free(rtf_writer_t *w)
+{
+	int err;
+	if (!w)
+		return 0;
+	err = rtf_writer_flush(w);
+	free(w);
+	return err;
+}
+
+rtf_table_t *
+rtf_table_begin(rtf_writer_t *w, 
+		int coln, const int *width, int borders)
+{
+	rtf_table_t *t;
+	int i, wd = 0, err;
+
+	if (!w || coln < 1)
+		return NULL;
+
+	t = (rtf_table_t *)malloc(sizeof(rtf_table_t));
+	if (!t)
+		return NULL;
+	t->w    = w;
+	t->coln = coln;
+	t->colv = (const char **)malloc(coln * sizeof(char *));
+	t->lens = (size_t *)malloc(coln * sizeof(size_t));
+	if (!t->colv || !t->lens || str_init(&t->prefix, BUFSIZ)){
+		free(t->colv);
+		free(t->lens);
+		free(t);
+		return NULL;
+	}
+
+	// row prefix
+	err = str_appendf(&t->prefix, "\\trowd\n");
+	for (i = 0; i < coln; ++i) {
+		wd += width[i];
+		if (borders & RTF_BORDER_TOP)
+			err |= str_appendf(&t->prefix, "\\clbrdrt\\brdrs");
+		if (borders & RTF_BORDER_LEFT)
+			err |= str_appendf(&t->prefix, "\\clbrdrl\\brdrs");
+		if (borders & RTF_BORDER_BOTTOM)
+			err |= str_appendf(&t->prefix, "\\clbrdrb\\brdrs");
+		if (borders & RTF_BORDER_RIGHT)
+			err |= str_appendf(&t->prefix, "\\clbrdrr\\brdrs");
+		err |= str_appendf(&t->prefix, "\n\\cellx%d\n", wd);
+	}
+	if (err){
+		t->w = NULL;
+		rtf_table_end(t);
+		return NULL;
+	}
+	return t;
+}
+
+static int
+_rtf_table_row(rtf_table_t *t, const char *colv[], const size_t lens[])
+{
+	rtf_writer_t *w = t->w;
+	int i;
+	
+	rtf_writer_raw(w, t->prefix.str, t->prefix.len);
+	for (i = 0; i < t->coln; ++i) {
+		rtf_writer_raw(w, "\\intbl ", 7);
+		if (colv[i])
+			rtf_writer_text(w, colv[i], 
+					lens && lens[i] != (size_t)-1 ? 
+					lens[i] : strlen(colv[i]));
+		rtf_writer_raw(w, " \\cell\n", 7);
+	}
+	return rtf_writer_raw(w, "\\row\n", 5);
+}
+
+int
+rtf_table_add_row(rtf_table_t *t, const char *colv[])
+{
+	return _rtf_table_row(t, colv, NULL);
+}
+
+int
+rtf_table_add_rows(rtf_table_t *t, 
+		size_t nrows, const char *cells[])
+{
+	size_t i;
+	for (i = 0; i < nrows; ++i)
+		if (_rtf_table_row(t, cells + i * t->coln, NULL))
+			return t->w->err;
+	return 0;
+}
+
+int
+rtf_table_add_rows_cb(rtf_table_t *t, 
+		void *udata, rtf_table_row_cb next)
+{
+	int i;
+	for (;;) {
+		for (i = 0; i < t->coln; ++i) {
+			t->colv[i] = NULL;
+			t->lens[i] = (size_t)-1;
+		}
+		if (next(udata, t->colv, t->lens))
+			break;
+		if (_rtf_table_row(t, t->colv, t->lens))
+			return t->w->err;
+	}
+	return 0;
+}
+
+int
+rtf_table_end(rtf_table_t *t)
+{
+	int err = 0;
+	if (!t)
+		return 0;
+	if (t->w)
+		err = rtf_writer_printf(t->w, "\\pard\n");
+	free(t->prefix.str);
+	free(t->colv);
+	free(t->lens);
+	free(t);
+	return err;
+}
+
 #endif /* ifndef RTF_H_ */
@@ -0,0 +1,419 @@
+/**
+ * File              : rtfbatch.c
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/* batch conversion of RTF files to UTF-8 text on all cores
+ * USAGE:
+ * cc -O2 -o rtfbatch rtfbatch.c rtfreadr.c -lpthread
+ * ./rtfbatch [-j THREADS] [-o OUTDIR] [-l LIST] [-n] [-v] FILE|DIR...
+ *   -j THREADS - number of threads (default: number of cores)
+ *   -o OUTDIR  - write text files to OUTDIR (path of RTF file
+ *                with '/' changed to '_' and .txt extension),
+ *                default: next to RTF file
+ *   -l LIST    - read RTF files from LIST, one per line
+ *                ('-' for stdin)
+ *   -n         - do not write text files (parse only)
+ *   -v         - print time and error code of every file
+ * directories are searched for *.rtf files recursively
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "rtfreadr.h"
+#include "str.h"
+
+// error names of ecOK...ecOpenFile
+static const char *ec_names[] = {
+	"ok",
+	"stack underflow",
+	"stack overflow",
+	"unmatched brace",
+	"invalid hex",
+	"bad table",
+	"assertion",
+	"end of file",
+	"can't open file",
+};
+#define EC_MAX (sizeof(ec_names) / sizeof(*ec_names))
+
+struct job {
+	char  *path;
+	size_t size;    // size of RTF file
+	double time;    // parse and write time
+	int    ec;      // parser error code
+	int    werr;    // can't write text file
+};
+
+// deque of job indexes of one thread - owner takes jobs
+// from head, other threads steal from tail
+struct deque {
+	pthread_mutex_t lock;
+	size_t head, tail;
+};
+
+struct worker {
+	pthread_t     thread;
+	int           n;
+	struct deque  dq;
+};
+
+static struct job    *jobs;
+static size_t         njobs, sjobs;
+static struct worker *workers;
+static int            nworkers;
+static const char    *outdir;
+static int            fNoOutput, fVerbose;
+static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+add_job(const char *path)
+{
+	if (njobs == sjobs){
+		size_t size = sjobs ? sjobs * 2 : 1024;
+		void *p = realloc(jobs, size * sizeof(struct job));
+		if (!p)
+			return -1;
+		jobs  = p;
+		sjobs = size;
+	}
+	memset(&jobs[njobs], 0, sizeof(struct job));
+	jobs[njobs].path = strdup(path);
+	if (!jobs[njobs].path)
+		return -1;
+	njobs++;
+	return 0;
+}
+
+static int
+is_rtf(const char *path)
+{
+	size_t len = strlen(path);
+	return len > 4 && strcasecmp(path + len - 4, ".rtf") == 0;
+}
+
+/* add RTF file or all *.rtf files of directory */
+static int
+add_path(const char *path)
+{
+	struct stat st;
+	DIR *dir;
+	struct dirent *de;
+
+	if (stat(path, &st)){
+		fprintf(stderr, "can't stat: %s\n", path);
+		return 0;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return add_job(path);
+
+	dir = opendir(path);
+	if (!dir){
+		fprintf(stderr, "can't open directory: %s\n", path);
+		return 0;
+	}
+	while ((de = readdir(dir))) {
+		struct str sub;
+		if (de->d_name[0] == '.')
+			continue;
+		if (str_init(&sub, BUFSIZ) ||
+				str_appendf(&sub, "%s/%s", path, de->d_name))
+		{
+			closedir(dir);
+			return -1;
+		}
+		if (stat(sub.str, &st) == 0 &&
+				(S_ISDIR(st.st_mode) || is_rtf(sub.str)) &&
+				add_path(sub.str))
+		{
+			free(sub.str);
+			closedir(dir);
+			return -1;
+		}
+		free(sub.str);
+	}
+	closedir(dir);
+	return 0;
+}
+
+/* add files from list file */
+static int
+add_list(const char *list)
+{
+	char line[BUFSIZ];
+	FILE *fp = strcmp(list, "-") ? fopen(list, "r") : stdin;
+	if (!fp){
+		fprintf(stderr, "can't open list: %s\n", list);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] && add_path(line))
+			return -1;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return 0;
+}
+
+/* take job from own deque or steal it from others -
+ * return -1 when all jobs are taken */
+static long
+next_job(struct worker *w)
+{
+	long i = -1;
+	int k;
+
+	pthread_mutex_lock(&w->dq.lock);
+	if (w->dq.head < w->dq.tail)
+		i = w->dq.head++;
+	pthread_mutex_unlock(&w->dq.lock);
+	if (i >= 0)
+		return i;
+
+	// steal from tail of other deques
+	for (k = 1; k < nworkers; ++k) {
+		struct worker *v = &workers[(w->n + k) % nworkers];
+		pthread_mutex_lock(&v->dq.lock);
+		if (v->dq.head < v->dq.tail)
+			i = --v->dq.tail;
+		pthread_mutex_unlock(&v->dq.lock);
+		if (i >= 0)
+			return i;
+	}
+	return -1;
+}
+
+static int
+text_cb(void *udata, STREAM s, const prop_t *p,
+		const char *utf8, size_t len)
+{
+	(void)p;
+	if (s == sMain)
+		str_append((struct str *)udata, utf8, len);
+	return 0;
+}
+
+static int
+char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	(void)p;
+	if (s != sMain)
+		return 0;
+	switch (ch) {
+		case PAR:
+		case ROW:
+		case SECT:
+			return str_append((struct str *)udata, "\n", 1);
+		case CELL:
+			return str_append((struct str *)udata, "\t", 1);
+	}
+	return 0;
+}
+
+/* write text file of job - return non-null on error */
+static int
+write_text(struct job *j, struct str *text)
+{
+	struct str path;
+	FILE *fp;
+	int err;
+	size_t len = strlen(j->path);
+
+	if (is_rtf(j->path))
+		len -= 4;
+	if (str_init(&path, BUFSIZ))
+		return -1;
+	if (outdir){
+		size_t i, start;
+		err = str_appendf(&path, "%s/", outdir);
+		start = path.len;
+		err |= str_append(&path, j->path, len);
+		for (i = start; i < path.len; ++i)
+			if (path.str[i] == '/')
+				path.str[i] = '_';
+	} else
+		err = str_append(&path, j->path, len);
+	err |= str_append(&path, ".txt", 4);
+
+	if (!err && (fp = fopen(path.str, "wb"))){
+		err = fwrite(text->str, 1, text->len, fp) != text->len;
+		err |= fclose(fp);
+	} else
+		err = -1;
+	free(path.str);
+	return err;
+}
+
+static void *
+worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	struct str text;
+	prop_t prop;
+	rnotify_t no;
+	rtf_parser_t *p;
+	long i;
+
+	memset(&no, 0, sizeof(no));
+	no.udata   = &text;
+	no.text_cb = text_cb;
+	no.char_cb = char_cb;
+	if (str_init(&text, BUFSIZ))
+		return NULL;
+	p = rtf_parser_create(&prop, &no);
+	if (!p){
+		free(text.str);
+		return NULL;
+	}
+
+	while ((i = next_job(w)) >= 0) {
+		struct job *j = &jobs[i];
+		struct stat st;
+		double t = now();
+
+		if (stat(j->path, &st) == 0)
+			j->size = st.st_size;
+		text.len = 0;
+		j->ec = rtf_parser_parse_file(p, j->path);
+		if (!fNoOutput && j->ec == ecOK)
+			j->werr = write_text(j, &text);
+		j->time = now() - t;
+
+		if (fVerbose){
+			pthread_mutex_lock(&print_lock);
+			printf("%10.3f ms %12zu B  %-16s %s%s\n",
+					j->time * 1e3, j->size,
+					(size_t)j->ec < EC_MAX ? ec_names[j->ec] : "?", j->path,
+					j->werr ? " (can't write text)" : "");
+			pthread_mutex_unlock(&print_lock);
+		}
+	}
+
+	rtf_parser_destroy(p);
+	free(text.str);
+	return NULL;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+			"Usage: %s [-j THREADS] [-o OUTDIR] [-l LIST] [-n] [-v] "
+			"FILE|DIR...\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, k;
+	size_t i, per, bytes = 0, nerr = 0, nwerr = 0, ecs[EC_MAX + 1];
+	double t, wall, cpu = 0;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:o:l:nv")) != -1) {
+		switch (opt) {
+			case 'j':
+				nworkers = atoi(optarg);
+				break;
+			case 'o':
+				outdir = optarg;
+				break;
+			case 'l':
+				if (add_list(optarg))
+					return 1;
+				break;
+			case 'n':
+				fNoOutput = 1;
+				break;
+			case 'v':
+				fVerbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	for (k = optind; k < argc; ++k)
+		if (add_path(argv[k])){
+			fprintf(stderr, "can't allocate memory\n");
+			return 1;
+		}
+	if (njobs == 0){
+		usage(argv[0]);
+		return 1;
+	}
+	if (nworkers < 1)
+		nworkers = 1;
+	if ((size_t)nworkers > njobs)
+		nworkers = njobs;
+
+	// give every thread its part of jobs
+	workers = calloc(nworkers, sizeof(struct worker));
+	if (!workers){
+		fprintf(stderr, "can't allocate memory\n");
+		return 1;
+	}
+	per = njobs / nworkers;
+	for (k = 0; k < nworkers; ++k) {
+		workers[k].n = k;
+		pthread_mutex_init(&workers[k].dq.lock, NULL);
+		workers[k].dq.head = k * per;
+		workers[k].dq.tail = k == nworkers - 1 ? njobs : (k + 1) * per;
+	}
+
+	t = now();
+	for (k = 0; k < nworkers; ++k)
+		if (pthread_create(&workers[k].thread, NULL,
+					worker_thread, &workers[k]))
+		{
+			fprintf(stderr, "can't create thread\n");
+			return 1;
+		}
+	for (k = 0; k < nworkers; ++k)
+		pthread_join(workers[k].thread, NULL);
+	wall = now() - t;
+
+	// report
+	memset(ecs, 0, sizeof(ecs));
+	for (i = 0; i < njobs; ++i) {
+		bytes += jobs[i].size;
+		cpu   += jobs[i].time;
+		ecs[(size_t)jobs[i].ec < EC_MAX ? (size_t)jobs[i].ec : EC_MAX]++;
+		if (jobs[i].ec != ecOK)
+			nerr++;
+		if (jobs[i].werr)
+			nwerr++;
+		free(jobs[i].path);
+	}
+	printf("files:      %zu (%zu with errors, %zu not written)\n",
+			njobs, nerr, nwerr);
+	for (i = 0; i <= EC_MAX; ++i)
+		if (ecs[i])
+			printf("  %-16s %zu\n", i < EC_MAX ? ec_names[i] : "?", ecs[i]);
+	printf("threads:    %d\n", nworkers);
+	printf("time:       %.3f s (%.3f s in threads)\n", wall, cpu);
+	printf("throughput: %.2f MB/s, %.1f docs/s\n",
+			bytes / wall / 1e6, njobs / wall);
+
+	free(jobs);
+	free(workers);
+	return nerr || nwerr ? 2 : 0;
+}
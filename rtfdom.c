@@ -0,0 +1,577 @@
+/**
+ * File              : rtfdom.c
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/* build in-memory document model with parser callbacks
+ * USAGE:
+ * cc -O2 -c rtfdom.c rtfreadr.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rtfdom.h"
+#include "str.h"
+
+/* document builder - all arrays grow in heap while
+ * parsing and are moved to arena of document in the
+ * end; runs and paragraphs take ids of properties 
+ * interned by parser */
+typedef struct dom_builder {
+	rtf_dom_t *dom;
+	rtf_parser_t *p;      // parser with ids of CHP and PAP
+	prop_t     prop;
+	int        pap;       // paragraph properties of last run
+	struct str pars, runs, cells, rows, tables, picts;
+	struct str fonts, colors, styles;
+	struct str text;
+	struct str pend[2];   // runs of open paragraph of stream
+	struct str ptext[2];  // text of open paragraph of stream
+	int cell0;            // first paragraph of open cell
+	int row0;             // first cell of open row
+	int table;            // open table or -1
+	int err;              // out of memory
+} dom_builder;
+
+#define VEC_N(v, T) ((int)((v)->len / sizeof(T)))
+#define VEC_AT(v, T, i) (((T *)(v)->str)[i])
+
+/* push item to dynamic array - set err on error */
+static void
+vec_push(dom_builder *b, struct str *v, const void *item, size_t size)
+{
+	if (str_append(v, (const char *)item, size))
+		b->err = 1;
+}
+
+/* close open table */
+static void
+close_table(dom_builder *b)
+{
+	RTF_DOM_TABLE *t;
+	if (b->table < 0)
+		return;
+	t = &VEC_AT(&b->tables, RTF_DOM_TABLE, b->table);
+	t->nrows = VEC_N(&b->rows, RTF_ROW) - t->row;
+	t->npars = VEC_N(&b->pars, RTF_PARA) - t->par;
+	b->table = -1;
+}
+
+/* open table if it is not open */
+static void
+open_table(dom_builder *b)
+{
+	RTF_DOM_TABLE t;
+	if (b->table >= 0)
+		return;
+	t.row   = VEC_N(&b->rows, RTF_ROW);
+	t.nrows = 0;
+	t.par   = b->cell0;
+	t.npars = 0;
+	b->table = VEC_N(&b->tables, RTF_DOM_TABLE);
+	vec_push(b, &b->tables, &t, sizeof(t));
+}
+
+/* move runs of open paragraph of stream to document */
+static void
+close_par(dom_builder *b, STREAM s, int pap, int fIntbl)
+{
+	RTF_PARA par;
+	RTF_RUN *r = (RTF_RUN *)b->pend[s].str;
+	int i, n = VEC_N(&b->pend[s], RTF_RUN);
+	size_t off = b->text.len;
+
+	if (s == sMain){
+		if (fIntbl)
+			open_table(b);
+		else if (b->table >= 0)
+			close_table(b);
+	}
+
+	for (i = 0; i < n; ++i)
+		r[i].text += off;
+	vec_push(b, &b->runs, r, n * sizeof(RTF_RUN));
+	if (b->ptext[s].len)
+		vec_push(b, &b->text, b->ptext[s].str, b->ptext[s].len);
+	b->pend[s].len = 0;
+	b->ptext[s].len = 0;
+
+	par.run   = VEC_N(&b->runs, RTF_RUN) - n;
+	par.nruns = n;
+	par.pap   = pap;
+	par.cell  = -1;
+	par.s     = s;
+	vec_push(b, &b->pars, &par, sizeof(par));
+
+	// paragraphs out of table are not part of next cell
+	if (s == sMain && !fIntbl)
+		b->cell0 = VEC_N(&b->pars, RTF_PARA);
+}
+
+static void
+close_cell(dom_builder *b, const prop_t *p)
+{
+	RTF_CELL cell;
+	int i, npars;
+
+	// cell has at least one (may be empty) paragraph
+	npars = VEC_N(&b->pars, RTF_PARA);
+	if (b->pend[sMain].len || npars == b->cell0 ||
+			VEC_AT(&b->pars, RTF_PARA, npars - 1).s != sMain)
+		close_par(b, sMain, rtf_parser_pap_id(b->p), fTrue);
+	if (b->err)
+		return;
+	open_table(b);
+
+	cell.par   = b->cell0;
+	cell.npars = VEC_N(&b->pars, RTF_PARA) - b->cell0;
+	cell.row   = -1;
+	cell.cellx = 0;
+	cell.tcp   = p->tcp;
+	for (i = cell.par; i < cell.par + cell.npars; ++i)
+		VEC_AT(&b->pars, RTF_PARA, i).cell = VEC_N(&b->cells, RTF_CELL);
+	vec_push(b, &b->cells, &cell, sizeof(cell));
+	b->cell0 = VEC_N(&b->pars, RTF_PARA);
+}
+
+static void
+close_row(dom_builder *b, const prop_t *p)
+{
+	RTF_ROW row;
+	int i, ncells;
+
+	if (b->pend[sMain].len)
+		close_cell(b, p);
+	ncells = VEC_N(&b->cells, RTF_CELL);
+	if (b->err || ncells == b->row0)
+		return;
+	open_table(b);
+
+	row.cell   = b->row0;
+	row.ncells = ncells - b->row0;
+	row.table  = b->table;
+	row.trp    = p->trp;
+	for (i = 0; i < row.ncells; ++i) {
+		RTF_CELL *c = &VEC_AT(&b->cells, RTF_CELL, row.cell + i);
+		c->row   = VEC_N(&b->rows, RTF_ROW);
+		c->cellx = i < p->trp.ncellx ? p->trp.cellx[i] : 0;
+	}
+	vec_push(b, &b->rows, &row, sizeof(row));
+	b->row0 = ncells;
+}
+
+static int
+run_cb(void *udata, STREAM s, int chp, int pap,
+		const char *utf8, size_t len)
+{
+	dom_builder *b = udata;
+	RTF_RUN *last, run;
+
+	if ((unsigned)s > sFootnotes)
+		return 0;
+	if (chp < 0 || pap < 0)
+		b->err = 1;
+	b->pap = pap;
+	// properties are restored when document group ends
+	b->dom->dop = b->prop.dop;
+
+	// join with previous run of the same properties
+	last = b->pend[s].len ?
+		&((RTF_RUN *)(b->pend[s].str + b->pend[s].len))[-1] : NULL;
+	if (last && last->pict < 0 && last->chp == chp)
+		last->len += len;
+	else {
+		run.text = b->ptext[s].len;
+		run.len  = len;
+		run.chp  = chp;
+		run.pict = -1;
+		vec_push(b, &b->pend[s], &run, sizeof(run));
+	}
+	vec_push(b, &b->ptext[s], utf8, len);
+	return 0;
+}
+
+static int
+char_cb(void *udata, STREAM s, prop_t *p, int ch)
+{
+	dom_builder *b = udata;
+	int pap;
+	if ((unsigned)s > sFootnotes)
+		return 0;
+	// properties are restored when document group ends
+	b->dom->dop = p->dop;
+	switch (ch) {
+		case PAR:
+			pap = rtf_parser_pap_id(b->p);
+			close_par(b, s, pap, p->pap.fIntbl);
+			break;
+		case SECT:
+			// section break ends paragraph if it has text
+			if (b->pend[s].len){
+				pap = rtf_parser_pap_id(b->p);
+				close_par(b, s, pap, p->pap.fIntbl);
+			}
+			break;
+		case CELL:
+			if (s == sMain)
+				close_cell(b, p);
+			break;
+		case ROW:
+			if (s == sMain)
+				close_row(b, p);
+			break;
+	}
+	return 0;
+}
+
+static int
+pict_cb(void *udata, prop_t *p, PICT *pict)
+{
+	dom_builder *b = udata;
+	PICT pc = *pict;
+	RTF_RUN run;
+	int s = pict->stream == sFootnotes ? sFootnotes : sMain;
+
+	b->dom->dop = p->dop;
+	pc.data = arena_memdup(&b->dom->arena, pict->data, pict->len);
+	if (!pc.data && pict->len){
+		b->err = 1;
+		return 0;
+	}
+	run.text = b->ptext[s].len;
+	run.len  = 0;
+	run.chp  = rtf_parser_chp_id(b->p);
+	b->pap   = rtf_parser_pap_id(b->p);
+	if (run.chp < 0 || b->pap < 0)
+		b->err = 1;
+	run.pict = VEC_N(&b->picts, PICT);
+	vec_push(b, &b->picts, &pc, sizeof(pc));
+	vec_push(b, &b->pend[s], &run, sizeof(run));
+	return 0;
+}
+
+static int
+font_cb(void *udata, FONT *f)
+{
+	dom_builder *b = udata;
+	vec_push(b, &b->fonts, f, sizeof(FONT));
+	return 0;
+}
+
+static int
+color_cb(void *udata, COLOR *c)
+{
+	dom_builder *b = udata;
+	vec_push(b, &b->colors, c, sizeof(COLOR));
+	return 0;
+}
+
+static int
+style_cb(void *udata, STYLE *s)
+{
+	dom_builder *b = udata;
+	vec_push(b, &b->styles, s, sizeof(STYLE));
+	return 0;
+}
+
+static int
+info_cb(void *udata, tINFO t, const char *s)
+{
+	dom_builder *b = udata;
+	if ((unsigned)t > info_hlinkbase)
+		return 0;
+	b->dom->info[t] = arena_strndup(&b->dom->arena, s, strlen(s));
+	if (!b->dom->info[t])
+		b->err = 1;
+	return 0;
+}
+
+static int
+date_cb(void *udata, tDATE t, DATE *d)
+{
+	dom_builder *b = udata;
+	if ((unsigned)t <= date_backup)
+		b->dom->dates[t] = *d;
+	return 0;
+}
+
+/* copy dynamic array to arena - return NULL if
+ * array is empty or on error */
+static void *
+vec_move(dom_builder *b, struct str *v, int *n, size_t size)
+{
+	void *p = NULL;
+	*n = v->len / size;
+	if (v->len){
+		p = arena_memdup(&b->dom->arena, v->str, v->len);
+		if (!p)
+			b->err = 1;
+	}
+	free(v->str);
+	memset(v, 0, sizeof(*v));
+	return p;
+}
+
+// max number of map of styles and fonts, other are
+// searched by linear scan
+#define DOM_MAPMAX 65536
+
+/* make map of numbers to indexes - items for which skip
+ * returns non-null are left out; if fLast, later item of
+ * the same number wins, else first one */
+static int *
+make_map(dom_builder *b, int *nmap, const void *items, int n,
+		size_t size, size_t off, int (*skip)(const void *), int fLast)
+{
+	int i, max = -1, *map;
+	for (i = 0; i < n; ++i) {
+		const char *item = (const char *)items + i * size;
+		int num = *(const int *)(item + off);
+		if (num > max && !(skip && skip(item)))
+			max = num;
+	}
+	*nmap = max < DOM_MAPMAX ? max + 1 : DOM_MAPMAX;
+	if (max < 0)
+		return NULL;
+	map = arena_alloc(&b->dom->arena, *nmap * sizeof(int));
+	if (!map){
+		b->err = 1;
+		return NULL;
+	}
+	for (i = 0; i < *nmap; ++i)
+		map[i] = -1;
+	for (i = 0; i < n; ++i) {
+		int k = fLast ? i : n - 1 - i;
+		const char *item = (const char *)items + k * size;
+		int num = *(const int *)(item + off);
+		if (num >= 0 && num < *nmap && !(skip && skip(item)))
+			map[num] = k;
+	}
+	return map;
+}
+
+/* section styles (\ds) are not in map of styles */
+static int
+is_ds(const void *item)
+{
+	return ((const STYLE *)item)->ds >= 0;
+}
+
+static void
+builder_free(dom_builder *b)
+{
+	int s;
+	free(b->pars.str);
+	free(b->runs.str);
+	free(b->cells.str);
+	free(b->rows.str);
+	free(b->tables.str);
+	free(b->picts.str);
+	free(b->fonts.str);
+	free(b->colors.str);
+	free(b->styles.str);
+	free(b->text.str);
+	for (s = 0; s < 2; ++s) {
+		free(b->pend[s].str);
+		free(b->ptext[s].str);
+	}
+}
+
+/* copy interned properties of parser to arena */
+static void *
+props_move(dom_builder *b, const void *first, int n, size_t size)
+{
+	void *p;
+	if (!n)
+		return NULL;
+	p = arena_memdup(&b->dom->arena, first, n * size);
+	if (!p)
+		b->err = 1;
+	return p;
+}
+
+/* close open paragraphs and tables and move arrays to
+ * arena of document */
+static void
+builder_finish(dom_builder *b)
+{
+	rtf_dom_t *dom = b->dom;
+	const PAP *pap;
+	int s;
+
+	// document group is closed and properties are reset,
+	// so last paragraph takes properties of its last run
+	pap = rtf_parser_pap(b->p, b->pap);
+	for (s = sFootnotes; s >= sMain; --s)
+		if (b->pend[s].len)
+			close_par(b, s, b->pap, pap && pap->fIntbl);
+	close_table(b);
+
+	dom->pars   = vec_move(b, &b->pars,   &dom->npars,   sizeof(RTF_PARA));
+	dom->runs   = vec_move(b, &b->runs,   &dom->nruns,   sizeof(RTF_RUN));
+	dom->cells  = vec_move(b, &b->cells,  &dom->ncells,  sizeof(RTF_CELL));
+	dom->rows   = vec_move(b, &b->rows,   &dom->nrows,   sizeof(RTF_ROW));
+	dom->tables = vec_move(b, &b->tables, &dom->ntables, sizeof(RTF_DOM_TABLE));
+	dom->picts  = vec_move(b, &b->picts,  &dom->npicts,  sizeof(PICT));
+	dom->fonts  = vec_move(b, &b->fonts,  &dom->nfonts,  sizeof(FONT));
+	dom->colors = vec_move(b, &b->colors, &dom->ncolors, sizeof(COLOR));
+	dom->styles = vec_move(b, &b->styles, &dom->nstyles, sizeof(STYLE));
+
+	// ids of parser are indexes of properties
+	dom->nchps  = rtf_parser_nchps(b->p);
+	dom->chps   = props_move(b, rtf_parser_chp(b->p, 0), dom->nchps, sizeof(CHP));
+	dom->npaps  = rtf_parser_npaps(b->p);
+	dom->paps   = props_move(b, rtf_parser_pap(b->p, 0), dom->npaps, sizeof(PAP));
+
+	dom->ltext = b->text.len;
+	dom->text  = arena_strndup(&dom->arena,
+			b->text.str ? b->text.str : "", b->text.len);
+	if (!dom->text)
+		b->err = 1;
+
+	// later style of the same number wins as in parser
+	dom->style_map = make_map(b, &dom->nstyle_map, dom->styles,
+			dom->nstyles, sizeof(STYLE), offsetof(STYLE, s), is_ds, 1);
+	dom->font_map = make_map(b, &dom->nfont_map, dom->fonts,
+			dom->nfonts, sizeof(FONT), offsetof(FONT, num), NULL, 0);
+}
+
+/* parse with parser function and build document */
+static rtf_dom_t *
+dom_build(int (*parse)(rtf_parser_t *, const void *, size_t, int),
+		const void *src, size_t len, int nthreads, int *ec)
+{
+	struct arena a;
+	dom_builder b;
+	rnotify_t no;
+	rtf_parser_t *p;
+	int e;
+
+	memset(&b, 0, sizeof(b));
+	b.table = -1;
+	arena_init(&a, 0);
+	b.dom = arena_alloc(&a, sizeof(rtf_dom_t));
+	if (!b.dom){
+		if (ec)
+			*ec = ecStackOverflow;
+		return NULL;
+	}
+	memset(b.dom, 0, sizeof(rtf_dom_t));
+	b.dom->arena = a;
+
+	memset(&no, 0, sizeof(no));
+	no.udata    = &b;
+	no.font_cb  = font_cb;
+	no.info_cb  = info_cb;
+	no.date_cb  = date_cb;
+	no.style_cb = style_cb;
+	no.color_cb = color_cb;
+	no.char_cb  = char_cb;
+	no.run_cb   = run_cb;
+	no.pict_cb  = pict_cb;
+
+	b.p = p = rtf_parser_create(&b.prop, &no);
+	if (!p)
+		e = ecStackOverflow;
+	else {
+		e = parse(p, src, len, nthreads);
+		if (e == ecOK){
+			builder_finish(&b);
+			if (b.err)
+				e = ecStackOverflow;
+		}
+		rtf_parser_destroy(p);
+	}
+	builder_free(&b);
+	if (ec)
+		*ec = e;
+	if (e != ecOK){
+		rtf_dom_free(b.dom);
+		return NULL;
+	}
+	return b.dom;
+}
+
+static int
+parse_file(rtf_parser_t *p, const void *src, size_t len, int nthreads)
+{
+	(void)len;
+	if (nthreads == 1)
+		return rtf_parser_parse_file(p, src);
+	return rtf_parser_parse_file_parallel(p, src, nthreads);
+}
+
+static int
+parse_buffer(rtf_parser_t *p, const void *src, size_t len, int nthreads)
+{
+	if (nthreads == 1)
+		return rtf_parser_parse_buffer(p, src, len);
+	return rtf_parser_parse_buffer_parallel(p, src, len, nthreads);
+}
+
+static int
+parse_stream(rtf_parser_t *p, const void *src, size_t len, int nthreads)
+{
+	(void)len;
+	(void)nthreads;
+	return rtf_parser_parse(p, (FILE *)src);
+}
+
+rtf_dom_t *
+rtf_dom_parse_file(const char *path, int nthreads, int *ec)
+{
+	return dom_build(parse_file, path, 0, nthreads, ec);
+}
+
+rtf_dom_t *
+rtf_dom_parse_buffer(const char *buf, size_t len,
+		int nthreads, int *ec)
+{
+	return dom_build(parse_buffer, buf, len, nthreads, ec);
+}
+
+rtf_dom_t *
+rtf_dom_parse(FILE *fp, int *ec)
+{
+	return dom_build(parse_stream, fp, 0, 1, ec);
+}
+
+const STYLE *
+rtf_dom_style(const rtf_dom_t *dom, int s)
+{
+	int i;
+	if (s >= 0 && s < dom->nstyle_map)
+		return dom->style_map[s] < 0 ? 
+			NULL : &dom->styles[dom->style_map[s]];
+	for (i = dom->nstyles - 1; i >= 0; --i)
+		if (dom->styles[i].s == s && !is_ds(&dom->styles[i]))
+			return &dom->styles[i];
+	return NULL;
+}
+
+const FONT *
+rtf_dom_font(const rtf_dom_t *dom, int num)
+{
+	int i;
+	if (num >= 0 && num < dom->nfont_map)
+		return dom->font_map[num] < 0 ? 
+			NULL : &dom->fonts[dom->font_map[num]];
+	for (i = 0; i < dom->nfonts; ++i)
+		if (dom->fonts[i].num == num)
+			return &dom->fonts[i];
+	return NULL;
+}
+
+void
+rtf_dom_free(rtf_dom_t *dom)
+{
+	struct arena a;
+	if (!dom)
+		return;
+	// document itself lives in its arena
+	a = dom->arena;
+	arena_free(&a);
+}
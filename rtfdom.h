@@ -0,0 +1,129 @@
+/**
+ * File              : rtfdom.h
+ * Author            : Igor V. Sementsov <ig.kuzm@gmail.com>
+ * Date              : 17.10.2026
+ * Last Modified Date: 17.10.2026
+ * Last Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
+ */
+
+/* in-memory document model of RTF document
+ * USAGE:
+ * int ec;
+ * rtf_dom_t *dom = rtf_dom_parse_file("doc.rtf", 1, &ec);
+ * for (i = 0; i < dom->npars; ++i) {
+ *   RTF_PARA *par = &dom->pars[i];
+ *   for (k = par->run; k < par->run + par->nruns; ++k) {
+ *     RTF_RUN *run = &dom->runs[k];
+ *     const CHP *chp = &dom->chps[run->chp];
+ *     fwrite(dom->text + run->text, 1, run->len, stdout);
+ *   }
+ * }
+ * rtf_dom_free(dom);
+ *
+ * all nodes are kept in flat arrays and refer each other
+ * by index; all memory is taken from one arena and freed
+ * by rtf_dom_free */
+
+#ifndef RTFDOM_H
+#define RTFDOM_H
+#include <stdio.h>
+#include "rtfreadr.h"
+#include "arena.h"
+
+/* run of text (or picture) with the same character
+ * properties */
+typedef struct rtf_run {
+	int text;    // offset of UTF-8 text in dom->text
+	int len;     // length of text in bytes
+	int chp;     // index in dom->chps
+	int pict;    // index in dom->picts or -1 if text run
+} RTF_RUN;
+
+/* paragraph - runs from run to run + nruns */
+typedef struct rtf_para {
+	int    run;   // first run
+	int    nruns; // number of runs
+	int    pap;   // index in dom->paps
+	int    cell;  // index in dom->cells or -1 if not in table
+	STREAM s;     // stream of paragraph
+} RTF_PARA;
+
+/* table cell - paragraphs from par to par + npars */
+typedef struct rtf_cell {
+	int par;     // first paragraph
+	int npars;   // number of paragraphs
+	int row;     // index in dom->rows
+	int cellx;   // right boundary of cell in twips
+	TCP tcp;
+} RTF_CELL;
+
+/* table row - cells from cell to cell + ncells */
+typedef struct rtf_row {
+	int cell;    // first cell
+	int ncells;  // number of cells
+	int table;   // index in dom->tables
+	TRP trp;
+} RTF_ROW;
+
+/* table - rows from row to row + nrows, paragraphs
+ * of the table are from par to par + npars */
+typedef struct rtf_dom_table {
+	int row;     // first row
+	int nrows;   // number of rows
+	int par;     // first paragraph
+	int npars;   // number of paragraphs
+} RTF_DOM_TABLE;
+
+/* document */
+typedef struct rtf_dom {
+	RTF_PARA  *pars;   int npars;
+	RTF_RUN   *runs;   int nruns;
+	RTF_CELL  *cells;  int ncells;
+	RTF_ROW   *rows;   int nrows;
+	RTF_DOM_TABLE *tables; int ntables;
+	PICT      *picts;  int npicts;
+	FONT      *fonts;  int nfonts;
+	COLOR     *colors; int ncolors;
+	STYLE     *styles; int nstyles;
+	CHP       *chps;   int nchps;   // unique character properties
+	PAP       *paps;   int npaps;   // unique paragraph properties
+	char      *text;   size_t ltext;// UTF-8 text of all runs
+	char      *info[info_hlinkbase + 1]; // info strings or NULL
+	DATE       dates[date_backup + 1];
+	DOP        dop;                 // document properties
+
+	int       *style_map;   // index of style by number or -1
+	int        nstyle_map;
+	int       *font_map;    // index of font by number or -1
+	int        nfont_map;
+
+	struct arena arena;     // memory of document
+} rtf_dom_t;
+
+/* parse RTF file and build document on nthreads threads
+ * (see rtf_parser_parse_buffer_parallel) - return NULL
+ * on error and set ec (may be NULL) to error code */
+rtf_dom_t *rtf_dom_parse_file(const char *path,
+		int nthreads, int *ec);
+
+/* parse RTF document from memory buffer and build
+ * document on nthreads threads - return NULL on error
+ * and set ec (may be NULL) to error code */
+rtf_dom_t *rtf_dom_parse_buffer(const char *buf, size_t len,
+		int nthreads, int *ec);
+
+/* parse RTF file and build document - return NULL on
+ * error and set ec (may be NULL) to error code */
+rtf_dom_t *rtf_dom_parse(FILE *fp, int *ec);
+
+/* return paragraph style with number s or NULL - later
+ * definition of the same number wins */
+const STYLE *rtf_dom_style(const rtf_dom_t *dom, int s);
+
+/* return font with number num or NULL */
+const FONT *rtf_dom_font(const rtf_dom_t *dom, int num);
+
+/* free document */
+void rtf_dom_free(rtf_dom_t *dom);
+
+#endif /* ifndef RTFDOM_H */
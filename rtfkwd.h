@@ -0,0 +1,57 @@
+/* rtfkwd.h - generated by mkrtfkwd from rgsymRtf of rtfreadr.c
+ * DO NOT EDIT - run mkrtfkwd after changing rgsymRtf
+ * max probes: 5 */
+
+#ifndef RTFKWD_H
+#define RTFKWD_H
+
+#define RTF_KWD_NSYM      225
+#define RTF_KWD_HASH_SIZE 512
+
+static const short rgisymHash[RTF_KWD_HASH_SIZE] = {
+	  22,   -1,   -1,  149,   -1,   -1,   -1,   -1,   -1,   -1,   35,   -1,
+	  -1,   -1,   -1,  176,  180,   -1,   -1,   -1,   -1,  151,   29,   -1,
+	  -1,  101,  187,  206,   -1,   -1,   -1,   -1,  219,   -1,   -1,  196,
+	  -1,   79,   19,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   -1,
+	  -1,   -1,   -1,   -1,   96,  147,   -1,  167,  104,   -1,   -1,   -1,
+	  -1,   -1,   -1,   -1,   -1,   -1,  105,  120,  122,   -1,   -1,   63,
+	  -1,   -1,   -1,   -1,  162,   -1,   -1,  161,   -1,   -1,   80,   -1,
+	  58,   -1,   36,   91,   -1,   -1,  154,   -1,  215,  218,   52,   -1,
+	  88,  127,   -1,   -1,   -1,   -1,   -1,   -1,  117,   -1,  143,   -1,
+	  -1,   -1,   -1,   -1,   16,   40,   -1,   -1,  111,   -1,   -1,   -1,
+	  -1,   -1,   71,   -1,   21,  112,   74,   -1,   -1,  189,  220,  170,
+	  49,   83,   -1,   -1,  208,  198,   -1,   -1,   -1,  113,   -1,   -1,
+	  -1,   -1,   -1,   -1,   -1,   81,   -1,  175,  182,  213,   -1,   -1,
+	  27,   -1,   -1,  193,  191,  164,   -1,   -1,   -1,   -1,   39,   62,
+	 188,  109,   -1,   -1,   -1,  216,  217,   -1,   -1,  128,   13,  157,
+	 207,   42,   -1,   43,   -1,   -1,   -1,   -1,   53,   70,   37,   87,
+	  -1,   -1,   -1,   -1,   -1,  166,   30,  125,   -1,   -1,  116,   -1,
+	 102,   -1,  126,  212,   65,  106,  199,   -1,   -1,   -1,   -1,   -1,
+	 124,  131,   -1,   -1,  134,   85,  145,   -1,   94,   -1,  173,    9,
+	  90,  119,   64,   -1,   -1,   -1,   -1,  190,   -1,  130,   -1,   -1,
+	  47,   -1,   98,  155,  186,   -1,   92,  150,   -1,   -1,  174,   -1,
+	  -1,  114,  183,  224,   -1,   -1,  141,   -1,   -1,   95,   66,  139,
+	 153,  165,  181,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   68,  103,
+	 137,   -1,  211,   -1,   46,    4,   50,   -1,  205,   -1,   -1,   -1,
+	  -1,   -1,   18,   -1,   -1,   -1,   51,   -1,   61,   -1,   -1,  110,
+	 179,  140,   -1,   -1,   -1,   73,   -1,   -1,   28,  108,  136,   -1,
+	  -1,   -1,   -1,   -1,   -1,   31,   -1,   93,   72,  163,   82,  192,
+	  -1,   -1,  100,  132,   67,  214,   -1,   -1,  177,   -1,   -1,   -1,
+	  -1,   -1,   -1,    2,   -1,   11,   75,   97,  107,   56,   10,  123,
+	  -1,   -1,   76,  144,   -1,  160,   -1,   -1,  146,   -1,   -1,   -1,
+	  -1,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   -1,   89,  158,
+	   6,  200,  204,   -1,   -1,   -1,   -1,  148,   54,   -1,   -1,   -1,
+	  -1,   -1,   24,  115,  121,  209,   17,   -1,   -1,    3,   -1,   -1,
+	 202,   -1,   -1,   -1,   41,  142,  159,   -1,   78,  133,   -1,   25,
+	 221,   59,   -1,   -1,   -1,  152,   -1,   -1,   -1,   -1,   -1,   -1,
+	  -1,   -1,   48,  135,   -1,  171,  210,   -1,   84,   60,   -1,   -1,
+	  -1,   -1,   69,  156,   -1,   55,   99,   -1,   -1,   20,  201,   -1,
+	  -1,   -1,   57,  197,   -1,   -1,   -1,   -1,   23,    7,    1,   32,
+	 172,  185,  129,  222,   45,   38,   -1,   -1,   -1,  178,   -1,   86,
+	 194,  195,   77,   -1,   14,   -1,   12,   34,   44,   -1,   -1,   -1,
+	  -1,   -1,   15,   -1,   -1,    0,  184,   -1,  118,   -1,   -1,  168,
+	 223,   -1,   26,   -1,   -1,  203,   -1,   -1,   -1,    8,  169,   -1,
+	   5,   -1,  138,   -1,   -1,   -1,   -1,   -1,
+};
+
+#endif /* ifndef RTFKWD_H */
@@ -11,10 +11,27 @@
 #include <string.h>
 #include <ctype.h>
 #include <stddef.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if !defined(_WIN32) && !defined(RTF_NO_THREADS)
+#include <pthread.h>
+#endif
+#ifndef RTF_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#endif
 #include "mswordtype.h"
 #include "rtfreadr.h"
 #include "utf.h"
 #include "str.h"
+#include "cpg.h"
 
 typedef enum { 
 	rdsNorm, 
@@ -39,17 +56,42 @@ typedef enum {
 
 typedef struct save       // property save structure
 {
-	struct save *pNext;     // next save
+	unsigned char fSaved;   // mask of saved properties (1 << PROPTYPE)
 	CHP chp;
 	PAP pap;
 	SEP sep;
 	DOP dop;
 	RDS rds;
 	RIS ris;
+	int uc;                 // \uc value of outer group
 	TRP trp;
 	TCP tcp;
 } SAVE;
 
+typedef struct stylemap   // style number -> stylesheet index
+{
+	int *idx;               // index of style or -1
+	int  n;                 // numbers in map
+	int  size;              // allocated size of idx
+} STYLEMAP;
+
+typedef enum {            // where brace scan is
+	brText,                 // plain text
+	brEscape,               // after '\\'
+	brName,                 // in control word
+	brParam                 // in parameter of \bin
+} BRST;
+
+typedef struct brscan     // raw brace scan of skipped group
+{
+	int  depth;             // groups left to close
+	BRST st;
+	int  lbin;              // chars of "bin" matched or -1
+	bool fNeg;              // negative \bin parameter
+	long param;             // parameter of \bin
+	long cbBin;             // binary data left
+} BRSCAN;
+
 // What types of properties are there?
 typedef enum {
 	ipropBold, 
@@ -155,10 +197,22 @@ typedef enum {
 	ipropGutter,
 	ipropMargirror,
 	ipropIntbl,
+	ipropSbasedon,
+	ipropSnext,
 
 	ipropMax
 } IPROP;
 
+typedef struct styledef   // stylesheet entry
+{
+	STYLE st;
+	bool fDs;               // section style (\ds)
+	bool fResolved;         // \sbasedon is resolved
+	unsigned char rgfSet[(ipropMax + 7) / 8]; // props set by style
+} STYLEDEF;
+
+#define FSTYLESET(psd, iprop) ((psd)->rgfSet[(iprop) / 8] & 1 << (iprop) % 8)
+
 typedef enum {
 	actnSpec, 
 	actnByte, 
@@ -189,7 +243,9 @@ typedef struct propmod
 typedef enum {
 	ipfnBin, 
 	ipfnHex, 
-	ipfnSkipDest
+	ipfnSkipDest,
+	ipfnUc,
+	ipfnAnsicpg
 } IPFN;
 
 typedef enum {
@@ -219,6 +275,35 @@ typedef enum {
 	idestFootnote,
 } IDEST;
 
+// destination state of IDEST (to check that any callback
+// wants it)
+static const RDS rgrdsDest[] = {
+	rdsPict,        // idestPict
+	rdsSkip,        // idestSkip
+	rdsFonttbl,     // idestFnt
+	rdsColor,       // idestCol
+	rdsFalt,        // idestFalt
+	rdsStyle,       // idestStyle
+	rdsInfo,        // idestInfo
+	rdsInfoString,  // idestTitle
+	rdsInfoString,  // idestAuthor
+	rdsInfoString,  // idestSubject
+	rdsInfoString,  // idestComment
+	rdsInfoString,  // idestKeywords
+	rdsInfoString,  // idestManger
+	rdsInfoString,  // idestCompany
+	rdsInfoString,  // idestOperator
+	rdsInfoString,  // idestCategory
+	rdsInfoString,  // idestDoccomm
+	rdsInfoString,  // idestHlinkbase
+	rdsInfoDate,    // idestCreatim
+	rdsInfoDate,    // idestRevtim
+	rdsInfoDate,    // idestPrintim
+	rdsInfoDate,    // idestBuptim
+	rdsShppict,     // idestShppict
+	rdsFootnote,    // idestFootnote
+};
+
 typedef enum {
 	kwdChar, 
 	kwdDest, 
@@ -344,10 +429,13 @@ PROP rgprop [ipropMax] = {
 		 actnWord,   propDop,    offsetof(DOP, gutter),        // ipropGutter
 		 actnByte,   propDop,    offsetof(DOP, fMirror),       // ipropMargirror
 		 actnByte,   propPap,    offsetof(PAP, fIntbl),        // ipropIntbl
+		 actnSpec,   propPap,    0,                            // ipropSbasedon
+		 actnSpec,   propPap,    0,                            // ipropSnext
 
 };
 
 // Keyword descriptions
+// (run mkrtfkwd to regenerate rtfkwd.h after changing it)
 SYM rgsymRtf[] = {
 //   keyword       dflt       fPassDflt   kwd              idx
 		 "b",          1,         fFalse,     kwdProp,         ipropBold,
@@ -385,6 +473,7 @@ SYM rgsymRtf[] = {
 	   "\0x0a",      0,         fFalse,     kwdChar,         0x0a,
 	   "\0x0d",      0,         fFalse,     kwdChar,         0x0a,
 	   "\\",         0,         fFalse,     kwdChar,         '\\',
+	   "ansicpg",    1252,      fFalse,     kwdSpec,         ipfnAnsicpg,
 	   "author",     0,         fFalse,     kwdDest,         idestAuthor,
 	   "bin",        0,         fFalse,     kwdSpec,         ipfnBin,
 	   "blue",       0,         fFalse,     kwdProp,         ipropCblue,
@@ -530,6 +619,7 @@ SYM rgsymRtf[] = {
 	   "trrh",       0,         fFalse,     kwdProp,         ipropTrrh,
 	   "txe",        0,         fFalse,     kwdDest,         idestSkip,
 	   "u",          0,         fFalse,     kwdUTF,          0,
+	   "uc",         1,         fFalse,     kwdSpec,         ipfnUc,
 	   "version",    0,         fFalse,     kwdProp,         ipropVersion,
 	   "wbitmap",    0,         fFalse,     kwdProp,         ipropDbitmap,
 	   "wmetafile",  0,         fFalse,     kwdProp,         ipropWmf,
@@ -571,669 +661,3694 @@ SYM rgsymRtf[] = {
 	   "gutter",     0,         fFalse,     kwdProp,         ipropGutter,
 	   "margmirror", 1,         fTrue,      kwdProp,         ipropMargirror,
 	   "intbl",      1,         fTrue,      kwdProp,         ipropIntbl,
+	   "sbasedon",   0,         fFalse,     kwdProp,         ipropSbasedon,
+	   "snext",      0,         fFalse,     kwdProp,         ipropSnext,
 	 	};
 
+// Hex digit values (-1 if char is not hex digit)
+static const signed char rghexRtf[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+// table of interned properties
+typedef struct proptab {
+	struct str items;            // unique properties
+	int   *hash;                 // open addressing table of id + 1
+	size_t size;                 // size of hash (power of 2)
+	int    n;                    // number of unique properties
+	int    last;                 // id of last interned properties
+} PROPTAB;
+
 // Parser vars
-int cGroup;
-bool fSkipDestIfUnk;
-bool isUTF;
-long cbBin;
-long lParam;
-RDS rds;
-RIS ris;
-FONT fnt;
-COLOR col;
-SAVE *psave;
-FILE *fpIn;
-
-PICT pict;
-
-prop_t *prop;
-rnotify_t *no;
-
-// STYLESHEET
-STYLE stylesheet[256];
-int nstyles;
-
-// INFO
-char info[BUFSIZ] = {0};
-int  linfo = 0;
-tINFO tinfo;
-
-// DATE
-DATE date;
-tDATE tdate;
+struct rtf_parser {
+	int cGroup;
+	bool fSkipDestIfUnk;
+	int uc;                      // fallback chars of \u (\uc)
+	long cUcSkip;                // fallback chars left to skip
+	int ucHigh;                  // pending high surrogate of \u
+	BRSCAN skip;                 // raw scan of skipped destination
+	long cbBin;
+	long lParam;
+	RDS rds;
+	RIS ris;
+	int cNibble;                 // hex digits left of \'xx
+	int bHex;                    // value of \'xx
+	const CPGTAB *cpg;           // code page of \'xx (\ansicpg)
+	FONT fnt;
+	COLOR col;
+	SAVE *stack;                 // group stack (cGroup items used)
+	int   sstack;                // allocated size of group stack
+	int   cGroupMin;             // lowest cGroup since start of chunk
+	int   fTouched;              // props changed or copied since start of chunk
+	int   fReset;                // props reset before they are touched
+	bool  fPause;                // stop parsing after current token
+	int   fWant;                 // destinations callbacks want (1 << RDS)
+	bool  fStop;                 // rest of document is not wanted
+	bool  fPush;                 // input is given by rtf_feed
+	int   ecPush;                // error of rtf_feed
+	struct str carry;            // control word cut by end of rtf_feed input
+
+	// INPUT
+	const unsigned char *pIn;    // current position in input buffer
+	const unsigned char *pInEnd; // end of input buffer
+	FILE *fpIn;                  // file to refill buffer from
+	unsigned char *bufIn;        // block buffer for file input
+
+	// TEXT RUN
+	char run[BUFSIZ];            // buffered text run
+	const char *pRun;            // start of run (run buffer or input slice)
+	size_t lRun;                 // length of run
+	STREAM sRun;                 // stream of run
+
+	PICT pict;
+	struct str img;              // decoded picture data
+	int pictNibble;              // pending high nibble of picture hex or -1
+	bool fPictBegun;             // pict_begin_cb is called
+	size_t pictSent;             // bytes sent to pict_chunk_cb
+	size_t pictDrop;             // bytes dropped from start of img
+
+	prop_t *prop;
+	rnotify_t *no;
+
+	// INTERNED PROPERTIES
+	PROPTAB chps;                // unique CHP of document
+	PROPTAB paps;                // unique PAP of document
+
+	// STYLESHEET
+	STYLEDEF *stylesheet;        // styles and one being parsed
+	int   nstyles;               // number of parsed styles
+	int   sstyles;               // allocated size of stylesheet
+	int   nstylesCb;             // styles sent to style_cb
+	STYLEMAP mapStyle;           // paragraph styles by \s
+	STYLEMAP mapDStyle;          // section styles by \ds
+
+	// INFO
+	char info[BUFSIZ];
+	int  linfo;
+	tINFO tinfo;
+
+	// DATE
+	DATE date;
+	tDATE tdate;
+};
 
 // RTF parser declarations
-int ecPushRtfState(void);
-int ecPopRtfState(void);
-int ecParseRtfKeyword(FILE *fp);
-int ecParseChar(int c);
-int ecParseUTF(int c);
-int ecTranslateKeyword(char *szKeyword, int param, bool fParam);
-int ecPrintChar(int ch);
-int ecEndGroupAction(RDS rds);
-int ecApplyPropChange(IPROP iprop, long val);
-int ecChangeDest(IDEST idest);
-int ecParseSpecialKeyword(IPFN ipfn);
-int ecParseSpecialProperty(IPROP iprop, int val);
-int ecParseHexByte(void);
+int ecPushRtfState(rtf_parser_t *p);
+int ecPopRtfState(rtf_parser_t *p);
+int ecParseRtfKeyword(rtf_parser_t *p);
+int ecParseChar(rtf_parser_t *p, int c);
+int ecParseUTF(rtf_parser_t *p, int c);
+int ecParseByte(rtf_parser_t *p, int c);
+int ecTranslateKeyword(rtf_parser_t *p, char *szKeyword, int param, bool fParam);
+int ecPrintChar(rtf_parser_t *p, int ch);
+int ecEndGroupAction(rtf_parser_t *p, RDS rds);
+int ecApplyPropChange(rtf_parser_t *p, IPROP iprop, long val);
+int ecChangeDest(rtf_parser_t *p, IDEST idest);
+int ecParseSpecialKeyword(rtf_parser_t *p, IPFN ipfn);
+int ecParseSpecialProperty(rtf_parser_t *p, IPROP iprop, int val);
+int ecParseHexByte(rtf_parser_t *p);
+int ecParseRun(rtf_parser_t *p, const unsigned char *s, size_t len);
+void ecFlushPicture(rtf_parser_t *p, bool fEnd);
+int ecAddPictureBin(rtf_parser_t *p, const unsigned char *s, size_t len);
 
 
 int isymMax = sizeof(rgsymRtf) / sizeof(SYM);
 
-struct str img;
+// control word is cut by end of input given by rtf_feed
+// - it is never returned to caller
+#define ecMoreInput           -1
+
+// size of picture chunk for pict_chunk_cb
+#ifndef RTF_PICTCHUNK
+#define RTF_PICTCHUNK 65536
+#endif
+
+#ifndef RTF_KWD_GEN
+// hash table of rgsymRtf indexes generated by mkrtfkwd
+#include "rtfkwd.h"
+// fails to compile if rtfkwd.h is out of date
+typedef char rtfkwd_h_is_out_of_date[
+	(sizeof(rgsymRtf) / sizeof(SYM) == RTF_KWD_NSYM) ? 1 : -1];
+#endif
 
 //
-// %%Function: ecApplyPropChange
+// %%Function: ecHashKeyword
 //
-// Set the property identified by _iprop_ to the value _val_.
+// FNV-1a hash of RTF keyword.
 //
+static inline unsigned int
+ecHashKeyword(const char *szKeyword)
+{
+	unsigned int h = 2166136261u;
+	while (*szKeyword)
+		h = (h ^ (unsigned char)*szKeyword++) * 16777619u;
+	return h;
+}
+
 //
-int
-ecApplyPropChange(IPROP iprop, long val)
+// %%Function: ecLookupKeyword
+//
+// Return index of szKeyword in rgsymRtf or -1 if
+// control word not found.
+//
+static inline int
+ecLookupKeyword(const char *szKeyword)
 {
-	char *pb;
-	if (rds == rdsSkip)             // If we're skipping text,
-		return ecOK;                  // don't do anything.
-		 
-	switch (rgprop[iprop].prop)
-	{
-		case propDop:
-			pb = (char *)&(prop->dop);
-			break;
-		case propSep:
-			pb = (char *)&(prop->sep);
-			break;
-		case propPap:
-			pb = (char *)&(prop->pap);
-			break;
-		case propChp:
-			pb = (char *)&(prop->chp);
-			break;
-		case propTrp:
-			pb = (char *)&(prop->trp);
-			break;
-		case propTcp:
-			pb = (char *)&(prop->tcp);
-			break;
-		case propFnt:
-			pb = (char *)&fnt;
-			break;
-		case propCol:
-			pb = (char *)&col;
-			break;
-		case propDate:
-			pb = (char *)&date;
-			break;
-		case propPict:
-			pb = (char *)&pict;
-			break;
-		 
-		default:
-			if (rgprop[iprop].actn != actnSpec)
-				return ecBadTable;
-			break;
+	int isym;
+#ifdef RTF_KWD_GEN
+	// no hash table yet - scan the whole table
+	for (isym = 0; isym < isymMax; isym++)
+		if (strcmp(szKeyword, rgsymRtf[isym].szKeyword) == 0)
+			return isym;
+	return -1;
+#else
+	unsigned int i = ecHashKeyword(szKeyword);
+	for (;; i++) {
+		isym = rgisymHash[i & (RTF_KWD_HASH_SIZE - 1)];
+		if (isym < 0)
+			return -1;
+		if (strcmp(szKeyword, rgsymRtf[isym].szKeyword) == 0)
+			return isym;
 	}
+#endif
+}
 
-	switch (rgprop[iprop].actn)
-	{
-		case actnByte:
-			pb[rgprop[iprop].offset] = (unsigned char) val;
-			break;
-		case actnWord:
-			(*(int *) (pb+rgprop[iprop].offset)) = val;
-			break;
-		case actnLong:
-			(*(long *) (pb+rgprop[iprop].offset)) = lParam;
-			break;
-		case actnSpec:
-			return ecParseSpecialProperty(iprop, val);
-			break;
-		 
-		default:
-			return ecBadTable;
-	}
-	return ecOK;
+// size of block buffer for file input
+#ifndef RTF_INBUFSIZ
+#define RTF_INBUFSIZ 65536
+#endif
+
+//
+// %%Function: ecHashChp
+//
+// FNV-1a hash of character properties.
+//
+static unsigned int
+ecHashChp(const void *pv)
+{
+	const CHP *c = pv;
+	unsigned int h = 2166136261u;
+	h = (h ^ (unsigned char)c->fBold) * 16777619u;
+	h = (h ^ (unsigned char)c->fUnderline) * 16777619u;
+	h = (h ^ (unsigned char)c->fItalic) * 16777619u;
+	h = (h ^ (unsigned int)c->font) * 16777619u;
+	h = (h ^ (unsigned int)c->size) * 16777619u;
+	h = (h ^ (unsigned int)c->fcolor) * 16777619u;
+	h = (h ^ (unsigned int)c->bcolor) * 16777619u;
+	return h ^ h >> 15;
+}
+
+static bool
+ecSameChp(const void *pa, const void *pb)
+{
+	const CHP *a = pa, *b = pb;
+	return a->fBold == b->fBold && a->fUnderline == b->fUnderline &&
+		a->fItalic == b->fItalic && a->font == b->font &&
+		a->size == b->size && a->fcolor == b->fcolor &&
+		a->bcolor == b->bcolor;
 }
 
 //
-// %%Function: ecParseSpecialProperty
+// %%Function: ecHashPap
 //
-// Set a property that requires code to evaluate.
+// FNV-1a hash of paragraph properties.
 //
-int
-ecParseSpecialProperty(IPROP iprop, int val)
+static unsigned int
+ecHashPap(const void *pv)
 {
-	switch (iprop)
-	{
-		case ipropPard:
-			memset(&(prop->pap), 0, sizeof(PAP));
-			return ecOK;
-		case ipropPlain:
-			memset(&(prop->chp), 0, sizeof(CHP));
-			return ecOK;
-		case ipropSectd:
-			memset(&(prop->sep), 0, sizeof(SEP));
-			return ecOK;
-		case ipropTrowd:
-			memset(&(prop->trp), 0, sizeof(TRP));
-			return ecOK;
-		case ipropTcelld:
-			memset(&(prop->tcp), 0, sizeof(TCP));
-			return ecOK;
-		
-		case ipropOmf:
-			pict.type = pict_omf;
-			pict.type_n = val;
-			return ecOK;
-		case ipropWmf:
-			pict.type = pict_wmf;
-			pict.type_n = val;
-			return ecOK;
-		case ipropIbitmap:
-			pict.type = pict_ibitmap;
-			pict.type_n = val;
-			return ecOK;
-		case ipropDbitmap:
-			pict.type = pict_dbitmap;
-			pict.type_n = val;
-			return ecOK;
-		
-		case ipropUd:  // we can read utf (use \ud and skip \udr)
-			return ecOK;
-		
-		case ipropFnum:
-			if (rds == rdsFonttbl)
-				fnt.num = val;
-			else
-				prop->chp.font = val;
-			return ecOK;
+	const PAP *c = pv;
+	unsigned int h = 2166136261u;
+	h = (h ^ (unsigned char)c->fIntbl) * 16777619u;
+	h = (h ^ (unsigned int)c->xaLeft) * 16777619u;
+	h = (h ^ (unsigned int)c->xaRight) * 16777619u;
+	h = (h ^ (unsigned int)c->xaFirst) * 16777619u;
+	h = (h ^ (unsigned int)c->just) * 16777619u;
+	h = (h ^ (unsigned int)c->s) * 16777619u;
+	return h ^ h >> 15;
+}
 
-		case ipropRowgaph:
-			prop->trp.trgaph[prop->trp.ntrgaph++] = val;
-		
-		case ipropCellx:
-			prop->trp.cellx[prop->trp.ncellx++] = val;
-		
-		case ipropStyle:
-			if (rds == rdsStyle) // add to stylesheet
-				stylesheet[nstyles].s = val;
-			else{
-				// apply styles to paragraph prop
-				int i;
-				for (i = 0; i < nstyles; ++i){
-					if (stylesheet[i].s == val){
-						prop->chp = stylesheet[i].chp;
-						prop->pap = stylesheet[i].pap;
-					}
-				}
-				prop->pap.s = val;
-			}
-			return ecOK;
-		
-		case ipropDStyle:
-			if (rds == rdsStyle) // add to stylesheet
-				stylesheet[nstyles].ds = val;
-			else {
-				// apply styles to section prop
-				int i;
-				for (i = 0; i < nstyles; ++i){
-					if (stylesheet[i].s == val){
-						prop->chp = stylesheet[i].chp;
-						prop->pap = stylesheet[i].pap;
-						prop->sep = stylesheet[i].sep;
-					}
-				}
-				prop->sep.ds = val;
-			}
-			return ecOK;
+static bool
+ecSamePap(const void *pa, const void *pb)
+{
+	const PAP *a = pa, *b = pb;
+	return a->fIntbl == b->fIntbl && a->xaLeft == b->xaLeft &&
+		a->xaRight == b->xaRight && a->xaFirst == b->xaFirst &&
+		a->just == b->just && a->s == b->s;
+}
 
-		default:
-			return ecBadTable;
+//
+// %%Function: ecInternProp
+//
+// Return id of properties in table of unique properties,
+// add them if not found. Return -1 if out of memory.
+//
+static int
+ecInternProp(PROPTAB *t, const void *pv, size_t size,
+		unsigned int (*hash)(const void *),
+		bool (*same)(const void *, const void *))
+{
+	size_t i;
+
+	// runs mostly repeat properties of previous run
+	if (t->n && same(t->items.str + t->last * size, pv))
+		return t->last;
+
+	// keep table at most half full
+	if ((size_t)t->n * 2 >= t->size){
+		size_t size2 = t->size ? t->size * 2 : 64;
+		int *hash2 = calloc(size2, sizeof(int)), id;
+		if (!hash2)
+			return -1;
+		for (id = 0; id < t->n; ++id) {
+			i = hash(t->items.str + id * size) & (size2 - 1);
+			while (hash2[i])
+				i = (i + 1) & (size2 - 1);
+			hash2[i] = id + 1;
+		}
+		free(t->hash);
+		t->hash = hash2;
+		t->size = size2;
 	}
-	return ecBadTable;
+
+	i = hash(pv) & (t->size - 1);
+	while (t->hash[i]) {
+		if (same(t->items.str + (t->hash[i] - 1) * size, pv))
+			return t->last = t->hash[i] - 1;
+		i = (i + 1) & (t->size - 1);
+	}
+	if (str_append(&t->items, pv, size))
+		return -1;
+	t->hash[i] = t->n + 1;
+	return t->last = t->n++;
 }
 
 //
-// %%Function: ecTranslateKeyword.
+// %%Function: ecResetPropTab
 //
-// Step 3.
-// Search rgsymRtf for szKeyword and evaluate it appropriately.
+// Drop interned properties, keep allocated memory.
 //
-// Inputs:
-// szKeyword:      The RTF control to evaluate.
-// param:          The parameter of the RTF control.
-// fParam:         fTrue if the control had a parameter; (that is, if param is valid)
-//                 fFalse if it did not.
+static void
+ecResetPropTab(PROPTAB *t)
+{
+	if (t->hash)
+		memset(t->hash, 0, t->size * sizeof(int));
+	t->items.len = 0;
+	t->n = 0;
+	t->last = 0;
+}
 
-int
-ecTranslateKeyword(char *szKeyword, int param, bool fParam)
+static void
+ecFreePropTab(PROPTAB *t)
 {
-	int isym;
-	
-	// search for szKeyword in rgsymRtf
-	for (isym = 0; isym < isymMax; isym++)
-		if (strcmp(szKeyword, rgsymRtf[isym].szKeyword) == 0)
-			break;
-			
-	if (isym == isymMax)        // control word not found
-	{
-		if (fSkipDestIfUnk)       // if this is a new destination
-			rds = rdsSkip;          // skip the destination
-															// else just discard it
-		fSkipDestIfUnk = fFalse;
-		return ecOK;
+	free(t->items.str);
+	free(t->hash);
+	memset(t, 0, sizeof(PROPTAB));
+}
+
+// style numbers less than RTF_STYLEMAP are found by map,
+// bigger ones by linear scan of stylesheet
+#ifndef RTF_STYLEMAP
+#define RTF_STYLEMAP 4096
+#endif
+
+// \sbasedon of style not based on other style
+#define STYLE_NONE 222
+
+//
+// %%Function: ecNewStyle
+//
+// Make room for next stylesheet entry and set its
+// defaults.
+//
+static int
+ecNewStyle(rtf_parser_t *p)
+{
+	STYLEDEF *psd;
+	if (p->nstyles >= p->sstyles){
+		int size = p->sstyles ? p->sstyles * 2 : 64;
+		void *ptr = realloc(p->stylesheet, size * sizeof(STYLEDEF));
+		if (!ptr)
+			return ecStackOverflow;
+		p->stylesheet = ptr;
+		p->sstyles = size;
 	}
+	psd = &p->stylesheet[p->nstyles];
+	memset(psd, 0, sizeof(STYLEDEF));
+	psd->st.ds = -1;
+	psd->st.sbedeon = STYLE_NONE;
+	psd->st.next = -1;
+	return ecOK;
+}
 
-	// found it!        
-	// use kwd and idx to determine what to do with it.
-	fSkipDestIfUnk = fFalse;
-	
-	switch (rgsymRtf[isym].kwd)
-	{
-		case kwdProp:
-			if (rgsymRtf[isym].fPassDflt || !fParam)
-				param = rgsymRtf[isym].dflt;
-			return ecApplyPropChange(rgsymRtf[isym].idx, param);
-		case kwdChar:
-			return ecParseChar(rgsymRtf[isym].idx);
-		case kwdDest:
-			return ecChangeDest(rgsymRtf[isym].idx);
-		case kwdSpec:
-			return ecParseSpecialKeyword(rgsymRtf[isym].idx);
-		case kwdUTF:
-			return ecParseUTF(param);
-			
-		default:
-			return ecBadTable;
+//
+// %%Function: ecMapStyle
+//
+// Set stylesheet index of style number. Later definition
+// of the same number wins.
+//
+static int
+ecMapStyle(STYLEMAP *m, int num, int i)
+{
+	if (num < 0 || num >= RTF_STYLEMAP)
+		return ecOK;
+	if (num >= m->size){
+		int size = m->size ? m->size : 64;
+		void *ptr;
+		while (size <= num)
+			size *= 2;
+		ptr = realloc(m->idx, size * sizeof(int));
+		if (!ptr)
+			return ecStackOverflow;
+		m->idx = ptr;
+		m->size = size;
 	}
-	return ecBadTable;
+	while (m->n <= num)
+		m->idx[m->n++] = -1;
+	m->idx[num] = i;
+	return ecOK;
 }
 
 //
-// %%Function: ecChangeDest
+// %%Function: ecFindStyle
 //
-// Change to the destination specified by idest.
-// There's usually more to do here than this...
+// Return stylesheet index of paragraph style (\s) or
+// section style (\ds) number or -1.
 //
-int
-ecChangeDest(IDEST idest)
+static int
+ecFindStyle(const rtf_parser_t *p, int num, bool fDs)
 {
-	if (rds == rdsSkip)    // if we're skipping text,
-		return ecOK;         // don't do anything
-	
-	switch (idest)
-	{
-		case idestFnt:
-			memset(&fnt, 0, sizeof(FONT));
-			rds = rdsFonttbl;
-			break;
+	const STYLEMAP *m = fDs ? &p->mapDStyle : &p->mapStyle;
+	int i;
+	if (num >= 0 && num < RTF_STYLEMAP)
+		return num < m->n ? m->idx[num] : -1;
+	for (i = p->nstyles - 1; i >= 0; --i)
+		if (p->stylesheet[i].fDs == fDs &&
+				(fDs ? p->stylesheet[i].st.ds : p->stylesheet[i].st.s) == num)
+			return i;
+	return -1;
+}
 
-		case idestCol:
-			memset(&col, 0, sizeof(COLOR));
-			rds = rdsColor;
-			break;
-		
-		case idestFalt:
-			rds = rdsFalt;
-			break;
-		
-		case idestStyle:
-			rds = rdsStyle;
-			break;
-		
-		case idestInfo:
-			rds = rdsInfo;
-			break;
-		
-		case idestFootnote:
-			rds = rdsFootnote;
-			break;
-		
-		case idestTitle:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_titile;
-			rds = rdsInfoString;
-			break;
-		
-		case idestSubject:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_subject;
-			rds = rdsInfoString;
-			break;
-		
-		case idestAuthor:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_author;
-			rds = rdsInfoString;
-			break;
-		
-		case idestManger:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_manager;
-			rds = rdsInfoString;
-			break;
-		
-		case idestCompany:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_company;
-			rds = rdsInfoString;
-			break;
-		
-		case idestOperator:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_operator;
-			rds = rdsInfoString;
+//
+// %%Function: ecResolveStyle
+//
+// Take props not set by style from style it is based on.
+//
+static void
+ecResolveStyle(rtf_parser_t *p, int i)
+{
+	STYLEDEF *psd = &p->stylesheet[i];
+	STYLE *ps = &psd->st;
+	const STYLE *base;
+	int ib;
+
+	if (p->stylesheet[i].fResolved)
+		return;
+	// mark first - loop of \sbasedon stops here
+	p->stylesheet[i].fResolved = fTrue;
+	if (ps->sbedeon == STYLE_NONE)
+		return;
+	ib = ecFindStyle(p, ps->sbedeon, p->stylesheet[i].fDs);
+	if (ib < 0 || ib == i)
+		return;
+	ecResolveStyle(p, ib);
+	base = &p->stylesheet[ib].st;
+
+#define INHERIT(f, iprop) if (!FSTYLESET(psd, iprop)) ps->f = base->f
+	INHERIT(chp.fBold,      ipropBold);
+	INHERIT(chp.fUnderline, ipropUnderline);
+	INHERIT(chp.fItalic,    ipropItalic);
+	INHERIT(chp.font,       ipropFnum);
+	INHERIT(chp.size,       ipropFsize);
+	INHERIT(chp.fcolor,     ipropFfcolor);
+	INHERIT(chp.bcolor,     ipropFbcolor);
+	INHERIT(pap.fIntbl,     ipropIntbl);
+	INHERIT(pap.xaLeft,     ipropLeftInd);
+	INHERIT(pap.xaRight,    ipropRightInd);
+	INHERIT(pap.xaFirst,    ipropFirstInd);
+	INHERIT(pap.just,       ipropJust);
+	INHERIT(sep.cCols,      ipropCols);
+	INHERIT(sep.sbk,        ipropSbk);
+	INHERIT(sep.xaPgn,      ipropPgnX);
+	INHERIT(sep.yaPgn,      ipropPgnY);
+	INHERIT(sep.pgnFormat,  ipropPgnFormat);
+#undef INHERIT
+}
+
+//
+// %%Function: ecEndStylesheet
+//
+// Resolve \sbasedon of new styles and send them to
+// style_cb.
+//
+static void
+ecEndStylesheet(rtf_parser_t *p)
+{
+	int i;
+	for (i = p->nstylesCb; i < p->nstyles; ++i)
+		ecResolveStyle(p, i);
+	if (p->no->style_cb)
+		for (i = p->nstylesCb; i < p->nstyles; ++i)
+			p->no->style_cb(p->no->udata, &p->stylesheet[i].st);
+	p->nstylesCb = p->nstyles;
+}
+
+//
+// %%Function: ecCopyStyles
+//
+// Copy stylesheet and style maps from src to dst.
+//
+static int
+ecCopyStyles(rtf_parser_t *dst, const rtf_parser_t *src)
+{
+	const STYLEMAP *ms[2] = {&src->mapStyle, &src->mapDStyle};
+	STYLEMAP *md[2] = {&dst->mapStyle, &dst->mapDStyle};
+	int i;
+
+	if (dst->sstyles < src->sstyles){
+		void *ptr = realloc(dst->stylesheet, src->sstyles * sizeof(STYLEDEF));
+		if (!ptr)
+			return ecStackOverflow;
+		dst->stylesheet = ptr;
+		dst->sstyles = src->sstyles;
+	}
+	// with entry being parsed
+	if (src->sstyles)
+		memcpy(dst->stylesheet, src->stylesheet, 
+				(src->nstyles < src->sstyles ? src->nstyles + 1 : src->nstyles) *
+				sizeof(STYLEDEF));
+	dst->nstyles = src->nstyles;
+	dst->nstylesCb = src->nstylesCb;
+
+	for (i = 0; i < 2; ++i) {
+		if (md[i]->size < ms[i]->n){
+			void *ptr = realloc(md[i]->idx, ms[i]->size * sizeof(int));
+			if (!ptr)
+				return ecStackOverflow;
+			md[i]->idx = ptr;
+			md[i]->size = ms[i]->size;
+		}
+		if (ms[i]->n)
+			memcpy(md[i]->idx, ms[i]->idx, ms[i]->n * sizeof(int));
+		md[i]->n = ms[i]->n;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: ecFlushRun
+//
+// Send buffered text run to run_cb or text_cb.
+//
+static void
+ecFlushRun(rtf_parser_t *p)
+{
+	if (p->lRun){
+		if (p->no->run_cb)
+			p->no->run_cb(p->no->udata, p->sRun, 
+					rtf_parser_chp_id(p), rtf_parser_pap_id(p),
+					p->pRun, p->lRun);
+		else
+			p->no->text_cb(p->no->udata, p->sRun, p->prop, p->pRun, p->lRun);
+		p->lRun = 0;
+	}
+}
+
+//
+// %%Function: ecAddRun
+//
+// Append text to text run. If fSlice is set the text is a
+// slice of the input buffer - it is not copied while it is
+// the whole run.
+//
+static void
+ecAddRun(rtf_parser_t *p, STREAM s, const char *str, size_t len, bool fSlice)
+{
+	if (p->lRun && (p->sRun != s || p->lRun + len > sizeof(p->run)))
+		ecFlushRun(p);
+	if (!p->lRun){
+		p->sRun = s;
+		if (fSlice){
+			p->pRun = str;
+			p->lRun = len;
+			return;
+		}
+		p->pRun = p->run;
+	} else if (p->pRun != p->run){
+		memcpy(p->run, p->pRun, p->lRun);
+		p->pRun = p->run;
+	}
+	memcpy(p->run + p->lRun, str, len);
+	p->lRun += len;
+}
+
+//
+// %%Function: ecKeepRun
+//
+// Text run may point to input buffer - copy it to run
+// buffer (or send it, if it is too long) before the input
+// buffer is changed.
+//
+static void
+ecKeepRun(rtf_parser_t *p)
+{
+	if (p->lRun && p->pRun != p->run){
+		if (p->lRun > sizeof(p->run))
+			ecFlushRun(p);
+		else {
+			memcpy(p->run, p->pRun, p->lRun);
+			p->pRun = p->run;
+		}
+	}
+}
+
+//
+// %%Function: ecFillInput
+//
+// Read next block of file into input buffer and
+// return first char of it or EOF.
+//
+static int
+ecFillInput(rtf_parser_t *p)
+{
+	size_t len;
+	if (!p->fpIn)
+		return EOF;
+	ecKeepRun(p);
+	len = fread(p->bufIn, 1, RTF_INBUFSIZ, p->fpIn);
+	if (!len)
+		return EOF;
+	p->pIn = p->bufIn;
+	p->pInEnd = p->bufIn + len;
+	return *p->pIn++;
+}
+
+//
+// %%Function: ecGetc
+//
+// Get next char from input buffer.
+//
+static inline int
+ecGetc(rtf_parser_t *p)
+{
+	if (p->pIn < p->pInEnd)
+		return *p->pIn++;
+	return ecFillInput(p);
+}
+
+//
+// %%Function: ecIsSpecialChar
+//
+// True if char ends run of plain text.
+//
+static inline bool
+ecIsSpecialChar(int ch)
+{
+	return ch == '{' || ch == '}' || ch == '\\' ||
+	       ch == 0x0d || ch == 0x0a;
+}
+
+//
+// %%Function: ecScanRun
+//
+// Return pointer to the first special char of s (or end).
+// Plain text is checked by 32 (AVX2) or 16 (SSE2) bytes,
+// the block with special char is scanned bytewise.
+// RTF_NO_SIMD makes it scan bytewise only.
+//
+static inline const unsigned char *
+ecScanRun(const unsigned char *s, const unsigned char *end)
+{
+#if defined(RTF_NO_SIMD)
+#elif defined(__AVX2__)
+	const __m256i lb = _mm256_set1_epi8('{');
+	const __m256i rb = _mm256_set1_epi8('}');
+	const __m256i bs = _mm256_set1_epi8('\\');
+	const __m256i cr = _mm256_set1_epi8(0x0d);
+	const __m256i lf = _mm256_set1_epi8(0x0a);
+	while (end - s >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)s);
+		__m256i m = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, lb), 
+					_mm256_cmpeq_epi8(v, rb)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, bs),
+					_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), 
+						_mm256_cmpeq_epi8(v, lf))));
+		if (_mm256_movemask_epi8(m))
 			break;
-		
-		case idestCategory:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_category;
-			rds = rdsInfoString;
+		s += 32;
+	}
+#elif defined(__SSE2__)
+	const __m128i lb = _mm_set1_epi8('{');
+	const __m128i rb = _mm_set1_epi8('}');
+	const __m128i bs = _mm_set1_epi8('\\');
+	const __m128i cr = _mm_set1_epi8(0x0d);
+	const __m128i lf = _mm_set1_epi8(0x0a);
+	while (end - s >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, lb), _mm_cmpeq_epi8(v, rb)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, bs),
+					_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+		if (_mm_movemask_epi8(m))
 			break;
-		
-		case idestKeywords:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_keywords;
-			rds = rdsInfoString;
+		s += 16;
+	}
+#endif
+	while (s < end && !ecIsSpecialChar(*s))
+		s++;
+	return s;
+}
+
+//
+// %%Function: ecScanAscii
+//
+// Return pointer to the first 8-bit char of s (or end).
+// Checked by 32 (AVX2) or 16 (SSE2) bytes as ecScanRun.
+//
+static inline const unsigned char *
+ecScanAscii(const unsigned char *s, const unsigned char *end)
+{
+#if defined(RTF_NO_SIMD)
+#elif defined(__AVX2__)
+	while (end - s >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)s);
+		if (_mm256_movemask_epi8(v))
 			break;
-		
-		case idestComment:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_comment;
-			rds = rdsInfoString;
+		s += 32;
+	}
+#elif defined(__SSE2__)
+	while (end - s >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		if (_mm_movemask_epi8(v))
 			break;
-		
-		case idestDoccomm:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_doccomm;
-			rds = rdsInfoString;
+		s += 16;
+	}
+#endif
+	while (s < end && *s < 0x80)
+		s++;
+	return s;
+}
+
+//
+// %%Function: ecScanGroup
+//
+// Scan raw input for the end of group without parsing it:
+// count braces, skip control symbols (\{, \}, \\) and data
+// of \binN. Scan state is kept in b, so scan may go on with
+// next block of input. Return position after the brace
+// which closes the group (b->depth is 0) or end.
+//
+static const unsigned char *
+ecScanGroup(BRSCAN *b, const unsigned char *s, const unsigned char *end)
+{
+	int ch;
+	while (s < end) {
+		if (b->cbBin > 0){
+			size_t n = end - s;
+			if (n > (size_t)b->cbBin)
+				n = b->cbBin;
+			s += n;
+			b->cbBin -= n;
+			continue;
+		}
+		switch (b->st) {
+			case brText:
+				s = ecScanRun(s, end);
+				if (s == end)
+					break;
+				ch = *s++;
+				if (ch == '{')
+					b->depth++;
+				else if (ch == '}'){
+					if (--b->depth == 0)
+						return s;
+				} else if (ch == '\\')
+					b->st = brEscape;
+				break;
+
+			case brEscape:
+				ch = *s++;
+				if (isalpha(ch)){
+					b->st = brName;
+					b->lbin = ch == 'b' ? 1 : -1;
+				} else
+					b->st = brText; // control symbol
+				break;
+
+			case brName:
+				ch = *s;
+				if (isalpha(ch)){
+					b->lbin = b->lbin > 0 && b->lbin < 3 && ch == "bin"[b->lbin] ?
+						b->lbin + 1 : -1;
+					s++;
+					break;
+				}
+				if (b->lbin == 3 && (isdigit(ch) || ch == '-')){
+					b->st = brParam;
+					b->param = 0;
+					b->fNeg = ch == '-';
+					if (b->fNeg)
+						s++;
+					break;
+				}
+				b->st = brText;
+				if (ch == ' ')
+					s++;
+				break;
+
+			case brParam:
+				ch = *s;
+				if (isdigit(ch)){
+					if (b->param < 100000000)
+						b->param = b->param * 10 + ch - '0';
+					s++;
+					break;
+				}
+				if (!b->fNeg)
+					b->cbBin = b->param;
+				b->st = brText;
+				if (ch == ' ')
+					s++;
+				break;
+		}
+	}
+	return s;
+}
+
+//
+// %%Function: ecUngetc
+//
+// Push back last char got with ecGetc.
+//
+static inline void
+ecUngetc(rtf_parser_t *p, int ch)
+{
+	if (ch != EOF)
+		p->pIn--;
+}
+
+//
+// %%Function: ecSaveProp
+//
+// Save property block on top of the group stack before it
+// is changed first time inside the group (copy-on-write).
+//
+static inline void
+ecSaveProp(rtf_parser_t *p, PROPTYPE prop)
+{
+	SAVE *psave;
+	p->fTouched |= 1 << prop;
+	if (!p->cGroup)
+		return;
+	psave = &p->stack[p->cGroup - 1];
+	if (psave->fSaved & (1 << prop))
+		return;
+	psave->fSaved |= 1 << prop;
+	switch (prop)
+	{
+		case propChp:
+			psave->chp = p->prop->chp;
 			break;
-		
-		case idestHlinkbase:
-			info[0] = 0;
-			linfo = 0;
-			tinfo = info_hlinkbase;
-			rds = rdsInfoString;
+		case propPap:
+			psave->pap = p->prop->pap;
 			break;
-		
-		case idestCreatim:
-			memset(&date, 0, sizeof(DATE));
-			tdate = date_create;
-			rds = rdsInfoDate;
+		case propSep:
+			psave->sep = p->prop->sep;
 			break;
-		
-		case idestRevtim:
-			memset(&date, 0, sizeof(DATE));
-			tdate = date_revision;
-			rds = rdsInfoDate;
+		case propDop:
+			psave->dop = p->prop->dop;
 			break;
-		
-		case idestPrintim:
-			memset(&date, 0, sizeof(DATE));
-			tdate = date_print;
-			rds = rdsInfoDate;
+		case propTrp:
+			psave->trp = p->prop->trp;
 			break;
-		
-		case idestBuptim:
-			memset(&date, 0, sizeof(DATE));
-			tdate = date_backup;
-			rds = rdsInfoDate;
+		case propTcp:
+			psave->tcp = p->prop->tcp;
 			break;
-		
-		case idestShppict:
-			rds = rdsShppict;
+		default:
+			break;
+	}
+}
+
+//
+// %%Function: ecResetProps
+//
+// Mark props of mask, that are set to values independent of
+// their old values, as reset - if they are not touched
+// before (fTouched) since start of chunk on its group level.
+// It lets parallel parse use chunk parsed from other state.
+//
+static inline void
+ecResetProps(rtf_parser_t *p, int fTouched, int mask)
+{
+	if (p->cGroup == p->cGroupMin)
+		p->fReset |= mask & ~fTouched;
+}
+
+//
+// %%Function: ecResetProp
+//
+// Save property block before it is reset.
+//
+static inline void
+ecResetProp(rtf_parser_t *p, PROPTYPE prop)
+{
+	ecResetProps(p, p->fTouched, 1 << prop);
+	ecSaveProp(p, prop);
+}
+
+//
+// %%Function: ecSetStyleProp
+//
+// Mark property as set by style being parsed, so it is not
+// taken from \sbasedon style. \plain, \pard and \sectd
+// set all properties of their block.
+//
+static void
+ecSetStyleProp(rtf_parser_t *p, IPROP iprop)
+{
+	STYLEDEF *psd = &p->stylesheet[p->nstyles];
+	int i;
+	if (iprop == ipropPlain || iprop == ipropPard || iprop == ipropSectd){
+		for (i = 0; i < ipropMax; ++i)
+			if (rgprop[i].prop == rgprop[iprop].prop)
+				psd->rgfSet[i / 8] |= 1 << i % 8;
+	} else
+		psd->rgfSet[iprop / 8] |= 1 << iprop % 8;
+}
+
+//
+// %%Function: ecApplyPropChange
+//
+// Set the property identified by _iprop_ to the value _val_.
+//
+//
+int
+ecApplyPropChange(rtf_parser_t *p, IPROP iprop, long val)
+{
+	char *pb;
+	if (p->rds == rdsSkip)             // If we're skipping text,
+		return ecOK;                  // don't do anything.
+	if (p->rds == rdsStyle)
+		ecSetStyleProp(p, iprop);
+	
+	// formatting is going to change - end text run
+	if (p->lRun && rgprop[iprop].prop <= propTcp)
+		ecFlushRun(p);
+	if (rgprop[iprop].actn != actnSpec && rgprop[iprop].prop <= propTcp)
+		ecSaveProp(p, rgprop[iprop].prop);
+		 
+	switch (rgprop[iprop].prop)
+	{
+		case propDop:
+			pb = (char *)&(p->prop->dop);
+			break;
+		case propSep:
+			pb = (char *)&(p->prop->sep);
+			break;
+		case propPap:
+			pb = (char *)&(p->prop->pap);
+			break;
+		case propChp:
+			pb = (char *)&(p->prop->chp);
+			break;
+		case propTrp:
+			pb = (char *)&(p->prop->trp);
+			break;
+		case propTcp:
+			pb = (char *)&(p->prop->tcp);
+			break;
+		case propFnt:
+			pb = (char *)&p->fnt;
+			break;
+		case propCol:
+			pb = (char *)&p->col;
+			break;
+		case propDate:
+			pb = (char *)&p->date;
+			break;
+		case propPict:
+			pb = (char *)&p->pict;
+			break;
+		 
+		default:
+			if (rgprop[iprop].actn != actnSpec)
+				return ecBadTable;
+			break;
+	}
+
+	switch (rgprop[iprop].actn)
+	{
+		case actnByte:
+			pb[rgprop[iprop].offset] = (unsigned char) val;
+			break;
+		case actnWord:
+			(*(int *) (pb+rgprop[iprop].offset)) = val;
 			break;
+		case actnLong:
+			(*(long *) (pb+rgprop[iprop].offset)) = p->lParam;
+			break;
+		case actnSpec:
+			return ecParseSpecialProperty(p, iprop, val);
+			break;
+		 
+		default:
+			return ecBadTable;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: ecParseSpecialProperty
+//
+// Set a property that requires code to evaluate.
+//
+int
+ecParseSpecialProperty(rtf_parser_t *p, IPROP iprop, int val)
+{
+	switch (iprop)
+	{
+		case ipropPard:
+			ecResetProp(p, propPap);
+			memset(&(p->prop->pap), 0, sizeof(PAP));
+			return ecOK;
+		case ipropPlain:
+			ecResetProp(p, propChp);
+			memset(&(p->prop->chp), 0, sizeof(CHP));
+			return ecOK;
+		case ipropSectd:
+			ecResetProp(p, propSep);
+			memset(&(p->prop->sep), 0, sizeof(SEP));
+			return ecOK;
+		case ipropTrowd:
+			ecResetProp(p, propTrp);
+			memset(&(p->prop->trp), 0, sizeof(TRP));
+			return ecOK;
+		case ipropTcelld:
+			ecResetProp(p, propTcp);
+			memset(&(p->prop->tcp), 0, sizeof(TCP));
+			return ecOK;
 		
-		case idestPict:
-			{
-				memset(&pict, 0, sizeof(PICT));
-				// try to allocate memory
-				if (str_init(&img, 4194304))
-					rds = rdsSkip;
-				else
-					rds = rdsPict;
-			}
+		case ipropOmf:
+			p->pict.type = pict_omf;
+			p->pict.type_n = val;
+			return ecOK;
+		case ipropWmf:
+			p->pict.type = pict_wmf;
+			p->pict.type_n = val;
+			return ecOK;
+		case ipropIbitmap:
+			p->pict.type = pict_ibitmap;
+			p->pict.type_n = val;
+			return ecOK;
+		case ipropDbitmap:
+			p->pict.type = pict_dbitmap;
+			p->pict.type_n = val;
+			return ecOK;
+		
+		case ipropUd:  // we can read utf (use \ud and skip \udr)
+			return ecOK;
+		
+		case ipropFnum:
+			if (p->rds == rdsFonttbl)
+				p->fnt.num = val;
+			else {
+				ecSaveProp(p, propChp);
+				p->prop->chp.font = val;
+			}
+			return ecOK;
+
+		case ipropRowgaph:
+			ecSaveProp(p, propTrp);
+			if (p->prop->trp.ntrgaph < 
+					(int)(sizeof(p->prop->trp.trgaph) / sizeof(*p->prop->trp.trgaph)))
+				p->prop->trp.trgaph[p->prop->trp.ntrgaph++] = val;
+			return ecOK;
+		
+		case ipropCellx:
+			ecSaveProp(p, propTrp);
+			if (p->prop->trp.ncellx < 
+					(int)(sizeof(p->prop->trp.cellx) / sizeof(*p->prop->trp.cellx)))
+				p->prop->trp.cellx[p->prop->trp.ncellx++] = val;
+			return ecOK;
+		
+		case ipropStyle:
+			if (p->rds == rdsStyle) // add to stylesheet
+				p->stylesheet[p->nstyles].st.s = val;
+			else{
+				// apply styles to paragraph prop
+				int i, fTouched = p->fTouched;
+				ecSaveProp(p, propChp);
+				ecSaveProp(p, propPap);
+				if ((i = ecFindStyle(p, val, fFalse)) >= 0){
+					p->prop->chp = p->stylesheet[i].st.chp;
+					p->prop->pap = p->stylesheet[i].st.pap;
+					ecResetProps(p, fTouched, 
+							1 << propChp | 1 << propPap);
+				}
+				p->prop->pap.s = val;
+			}
+			return ecOK;
+		
+		case ipropDStyle:
+			if (p->rds == rdsStyle){ // add to stylesheet
+				p->stylesheet[p->nstyles].st.ds = val;
+				p->stylesheet[p->nstyles].fDs = fTrue;
+			} else {
+				// apply styles to section prop
+				int i, fTouched = p->fTouched;
+				ecSaveProp(p, propChp);
+				ecSaveProp(p, propPap);
+				ecSaveProp(p, propSep);
+				if ((i = ecFindStyle(p, val, fTrue)) >= 0){
+					p->prop->chp = p->stylesheet[i].st.chp;
+					p->prop->pap = p->stylesheet[i].st.pap;
+					p->prop->sep = p->stylesheet[i].st.sep;
+					ecResetProps(p, fTouched, 
+							1 << propChp | 1 << propPap | 1 << propSep);
+				}
+				p->prop->sep.ds = val;
+			}
+			return ecOK;
+
+		case ipropSbasedon:
+			if (p->rds == rdsStyle)
+				p->stylesheet[p->nstyles].st.sbedeon = val;
+			return ecOK;
+
+		case ipropSnext:
+			if (p->rds == rdsStyle)
+				p->stylesheet[p->nstyles].st.next = val;
+			return ecOK;
+
+		default:
+			return ecBadTable;
+	}
+	return ecBadTable;
+}
+
+//
+// %%Function: ecTranslateKeyword.
+//
+// Step 3.
+// Search rgsymRtf for szKeyword and evaluate it appropriately.
+//
+// Inputs:
+// szKeyword:      The RTF control to evaluate.
+// param:          The parameter of the RTF control.
+// fParam:         fTrue if the control had a parameter; (that is, if param is valid)
+//                 fFalse if it did not.
+
+int
+ecTranslateKeyword(rtf_parser_t *p, char *szKeyword, int param, bool fParam)
+{
+	// search for szKeyword in rgsymRtf
+	int isym = ecLookupKeyword(szKeyword);
+			
+	if (isym < 0)               // control word not found
+	{
+		if (p->fSkipDestIfUnk)       // if this is a new destination
+			p->rds = rdsSkip;          // skip the destination
+															// else just discard it
+		p->fSkipDestIfUnk = fFalse;
+		return ecOK;
+	}
+
+	// found it!        
+	// use kwd and idx to determine what to do with it.
+	p->fSkipDestIfUnk = fFalse;
+	
+	switch (rgsymRtf[isym].kwd)
+	{
+		case kwdProp:
+			if (rgsymRtf[isym].fPassDflt || !fParam)
+				param = rgsymRtf[isym].dflt;
+			return ecApplyPropChange(p, rgsymRtf[isym].idx, param);
+		case kwdChar:
+			return ecParseChar(p, rgsymRtf[isym].idx);
+		case kwdDest:
+			return ecChangeDest(p, rgsymRtf[isym].idx);
+		case kwdSpec:
+			return ecParseSpecialKeyword(p, rgsymRtf[isym].idx);
+		case kwdUTF:
+			// \u takes signed 16-bit value
+			return ecParseUTF(p, param < 0 ? param + 65536 : param);
+			
+		default:
+			return ecBadTable;
+	}
+	return ecBadTable;
+}
+
+//
+// %%Function: ecChangeDest
+//
+// Change to the destination specified by idest.
+// There's usually more to do here than this...
+//
+int
+ecChangeDest(rtf_parser_t *p, IDEST idest)
+{
+	if (p->rds == rdsSkip)    // if we're skipping text,
+		return ecOK;         // don't do anything
+	
+	if (!(p->fWant & 1 << rgrdsDest[idest])){
+		// no callback wants it
+		p->rds = rdsSkip;
+		return ecOK;
+	}
+	
+	switch (idest)
+	{
+		case idestFnt:
+			memset(&p->fnt, 0, sizeof(FONT));
+			p->rds = rdsFonttbl;
+			break;
+
+		case idestCol:
+			memset(&p->col, 0, sizeof(COLOR));
+			p->rds = rdsColor;
+			break;
+		
+		case idestFalt:
+			p->rds = rdsFalt;
+			break;
+		
+		case idestStyle:
+			// styles are parsed into entry after the last one
+			if (ecNewStyle(p) != ecOK){
+				p->rds = rdsSkip;
+				break;
+			}
+			p->rds = rdsStyle;
+			break;
+		
+		case idestInfo:
+			p->rds = rdsInfo;
+			break;
+		
+		case idestFootnote:
+			p->rds = rdsFootnote;
+			break;
+		
+		case idestTitle:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_titile;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestSubject:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_subject;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestAuthor:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_author;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestManger:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_manager;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestCompany:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_company;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestOperator:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_operator;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestCategory:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_category;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestKeywords:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_keywords;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestComment:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_comment;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestDoccomm:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_doccomm;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestHlinkbase:
+			p->info[0] = 0;
+			p->linfo = 0;
+			p->tinfo = info_hlinkbase;
+			p->rds = rdsInfoString;
+			break;
+		
+		case idestCreatim:
+			memset(&p->date, 0, sizeof(DATE));
+			p->tdate = date_create;
+			p->rds = rdsInfoDate;
+			break;
+		
+		case idestRevtim:
+			memset(&p->date, 0, sizeof(DATE));
+			p->tdate = date_revision;
+			p->rds = rdsInfoDate;
+			break;
+		
+		case idestPrintim:
+			memset(&p->date, 0, sizeof(DATE));
+			p->tdate = date_print;
+			p->rds = rdsInfoDate;
+			break;
+		
+		case idestBuptim:
+			memset(&p->date, 0, sizeof(DATE));
+			p->tdate = date_backup;
+			p->rds = rdsInfoDate;
+			break;
+		
+		case idestShppict:
+			p->rds = rdsShppict;
+			break;
+		
+		case idestPict:
+			{
+				int i;
+				if (p->img.str){
+					// \pict nested in picture - keep outer one
+					p->rds = rdsSkip;
+					break;
+				}
+				memset(&p->pict, 0, sizeof(PICT));
+				// picture of footnote may be nested in \shppict
+				p->pict.stream = p->rds == rdsFootnote ? sFootnotes : sMain;
+				for (i = 0; i < p->cGroup; ++i)
+					if (p->stack[i].rds == rdsFootnote)
+						p->pict.stream = sFootnotes;
+				p->pictNibble = -1;
+				p->fPictBegun = fFalse;
+				p->pictSent = 0;
+				p->pictDrop = 0;
+				// try to allocate memory - whole picture is kept
+				// only for pict_cb (buffer grows as needed), else
+				// it goes by chunks
+				if (str_init(&p->img, 
+							p->no->pict_cb ? BUFSIZ : RTF_PICTCHUNK * 2 + 2))
+					p->rds = rdsSkip;
+				else
+					p->rds = rdsPict;
+			}
+			break;
+		
+		default:
+			p->rds = rdsSkip;     // when in doubt, skip it...
+			break;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: ecEndGroupAction
+//
+// The destination specified by rds is coming to a close.
+// If there's any cleanup that needs to be done, do it now.
+//
+int
+ecEndGroupAction(rtf_parser_t *p, RDS rds)
+{
+	if (rds == rdsPict){
+		// picture data is already decoded from hex
+		if (p->img.str){
+			ecFlushPicture(p, fTrue);
+			// do callback
+			if (p->no->pict_cb){
+				p->pict.data = (unsigned char *)p->img.str;
+				p->pict.len = p->img.len;
+				p->no->pict_cb(p->no->udata, p->prop, &p->pict);
+			}
+			if (p->no->pict_end_cb)
+				p->no->pict_end_cb(p->no->udata, p->prop, &p->pict,
+						p->pictDrop + p->img.len);
+
+			free(p->img.str);
+			p->img.str = NULL;
+			p->pict.data = NULL;
+		}
+		return ecOK;
+	}
+	if (rds == rdsInfoString){
+		p->info[p->linfo] = 0;
+		if (*p->info)
+			if (p->no->info_cb)
+				p->no->info_cb(p->no->udata, p->tinfo, p->info);
+		return ecOK;
+	}
+	if (rds == rdsInfoDate){
+		if (p->no->date_cb)
+			p->no->date_cb(p->no->udata, p->tdate, &p->date);
+		return ecOK;
+	}
+	if (rds == rdsStyle){
+		ecEndStylesheet(p);
+		return ecOK;
+	}
+	if (rds == rdsInfo){
+		// only \info is wanted - the rest of document
+		// is not parsed
+		if (!(p->fWant & ~(1 << rdsSkip | 1 << rdsInfo |
+						1 << rdsInfoString | 1 << rdsInfoDate)))
+			p->fStop = fTrue;
+		return ecOK;
+	}
+
+	return ecOK;
+}
+
+//
+// %%Function: ecParseSpecialKeyword
+//
+// Evaluate an RTF control that needs special processing.
+//
+int
+ecParseSpecialKeyword(rtf_parser_t *p, IPFN ipfn)
+{
+	if (p->rds == rdsSkip && ipfn != ipfnBin) // if we're skipping, and it's not
+		return ecOK;                         // the \bin keyword, ignore it.
+			 
+	switch (ipfn)
+	{
+		case ipfnBin:
+			if (p->lParam > 0){
+				p->ris = risBin;
+				p->cbBin = p->lParam;
+			}
+			break;
+		case ipfnSkipDest:
+			p->fSkipDestIfUnk = fTrue;
+			break;
+		case ipfnHex:
+			p->ris = risHex;
+		break;
+		case ipfnUc:
+			p->uc = p->lParam > 0 ? p->lParam : 0;
+			break;
+		case ipfnAnsicpg:
+			p->cpg = cpg_table(p->lParam);
+			break;
+			 
+		default:
+			return ecBadTable;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: rtf_parser_create
+//
+// Allocate parser context. All parser state lives here,
+// so every thread can parse its own document.
+//
+rtf_parser_t *
+rtf_parser_create(prop_t *prop, rnotify_t *no)
+{
+	rtf_parser_t *p = calloc(1, sizeof(rtf_parser_t));
+	if (!p)
+		return NULL;
+	p->prop = prop;
+	p->no = no;
+	return p;
+}
+
+//
+// %%Function: ecFreeRtfState
+//
+// Free picture left from unfinished parse.
+//
+static void
+ecFreeRtfState(rtf_parser_t *p)
+{
+	if (p->img.str){
+		free(p->img.str);
+		p->img.str = NULL;
+	}
+}
+
+//
+// %%Function: rtf_parser_destroy
+//
+// Free parser context.
+//
+void
+rtf_parser_destroy(rtf_parser_t *p)
+{
+	if (!p)
+		return;
+	ecFreeRtfState(p);
+	ecFreePropTab(&p->chps);
+	ecFreePropTab(&p->paps);
+	free(p->stylesheet);
+	free(p->mapStyle.idx);
+	free(p->mapDStyle.idx);
+	free(p->stack);
+	free(p->bufIn);
+	free(p->carry.str);
+	free(p);
+}
+
+//
+// %%Function: rtf_parser_chp_id
+//
+// Return id of current character properties.
+//
+int
+rtf_parser_chp_id(rtf_parser_t *p)
+{
+	return ecInternProp(&p->chps, &p->prop->chp, sizeof(CHP),
+			ecHashChp, ecSameChp);
+}
+
+//
+// %%Function: rtf_parser_pap_id
+//
+// Return id of current paragraph properties.
+//
+int
+rtf_parser_pap_id(rtf_parser_t *p)
+{
+	return ecInternProp(&p->paps, &p->prop->pap, sizeof(PAP),
+			ecHashPap, ecSamePap);
+}
+
+//
+// %%Function: rtf_parser_chp
+//
+// Return character properties by id or NULL.
+//
+const CHP *
+rtf_parser_chp(rtf_parser_t *p, int id)
+{
+	if (id < 0 || id >= p->chps.n)
+		return NULL;
+	return (const CHP *)p->chps.items.str + id;
+}
+
+//
+// %%Function: rtf_parser_pap
+//
+// Return paragraph properties by id or NULL.
+//
+const PAP *
+rtf_parser_pap(rtf_parser_t *p, int id)
+{
+	if (id < 0 || id >= p->paps.n)
+		return NULL;
+	return (const PAP *)p->paps.items.str + id;
+}
+
+int
+rtf_parser_nchps(rtf_parser_t *p)
+{
+	return p->chps.n;
+}
+
+int
+rtf_parser_npaps(rtf_parser_t *p)
+{
+	return p->paps.n;
+}
+
+//
+// %%Function: ecWantedDests
+//
+// Mask of destinations (1 << RDS) some callback of no
+// wants - others are skipped with brace scan. Body props
+// (and so stylesheet) go to text and picture callbacks,
+// command_cb wants every control word.
+//
+static int
+ecWantedDests(const rnotify_t *no)
+{
+	int f = 1 << rdsSkip;
+	bool fText = no->char_cb || no->text_cb || no->run_cb;
+	bool fPict = no->pict_cb || no->pict_begin_cb ||
+		no->pict_chunk_cb || no->pict_end_cb;
+
+	if (no->command_cb)
+		return ~0;
+	if (fText)
+		f |= 1 << rdsNorm;
+	if (fText || fPict)
+		f |= 1 << rdsFootnote | 1 << rdsStyle;
+	if (fPict)
+		f |= 1 << rdsShppict | 1 << rdsPict;
+	if (no->style_cb)
+		f |= 1 << rdsStyle;
+	if (no->font_cb)
+		f |= 1 << rdsFonttbl | 1 << rdsFalt;
+	if (no->color_cb)
+		f |= 1 << rdsColor;
+	if (no->info_cb)
+		f |= 1 << rdsInfo | 1 << rdsInfoString;
+	if (no->date_cb)
+		f |= 1 << rdsInfo | 1 << rdsInfoDate;
+	return f;
+}
+
+//
+// %%Function: ecResetRtfState
+//
+// Set parser state to defaults before parsing new document.
+//
+static void
+ecResetRtfState(rtf_parser_t *p)
+{
+	ecFreeRtfState(p);
+	p->cGroup = 0;
+	p->fSkipDestIfUnk = fFalse;
+	p->uc = 1;
+	p->cUcSkip = 0;
+	p->ucHigh = 0;
+	memset(&p->skip, 0, sizeof(BRSCAN));
+	p->cbBin = 0;
+	p->lParam = 0;
+	p->rds = rdsNorm;
+	p->ris = risNorm;
+	p->cNibble = 2;
+	p->bHex = 0;
+	p->cpg = cpg_table(1252);
+	memset(&p->fnt, 0, sizeof(FONT));
+	memset(&p->col, 0, sizeof(COLOR));
+	memset(&p->pict, 0, sizeof(PICT));
+	p->nstyles = 0;
+	p->nstylesCb = 0;
+	p->mapStyle.n = 0;
+	p->mapDStyle.n = 0;
+	p->info[0] = 0;
+	p->linfo = 0;
+	memset(&p->date, 0, sizeof(DATE));
+	p->lRun = 0;
+	p->fPause = fFalse;
+	p->fWant = ecWantedDests(p->no);
+	p->fStop = fFalse;
+	p->fPush = fFalse;
+	p->ecPush = ecOK;
+	p->carry.len = 0;
+	ecResetPropTab(&p->chps);
+	ecResetPropTab(&p->paps);
+	// set prop to 0
+	memset(p->prop, 0, sizeof(prop_t));
+}
+
+//
+// %%Function: ecRtfParseBlock
+//
+// Step 1:
+// Isolate RTF keywords and send them to ecParseRtfKeyword;
+// Push and pop state at the start and end of RTF groups;
+// Send text to ecParseChar for further processing.
+// Skipped destinations are passed with raw brace scan
+// (unless command_cb wants all keywords).
+// Parse until the end of input or until fPause is set -
+// all state is kept in parser, so parsing may go on with
+// next block of input.
+
+static int
+ecRtfParseBlock(rtf_parser_t *p)
+{
+	int ch;
+	int ec;
+	while (!p->fPause && !p->fStop)
+	{
+		if (p->rds == rdsSkip && p->ris == risNorm && p->cGroup > 0 &&
+				!p->no->command_cb)
+		{
+			// skip the rest of destination up to its closing
+			// brace - no keywords, groups or chars are parsed
+			if (!p->skip.depth){
+				memset(&p->skip, 0, sizeof(BRSCAN));
+				p->skip.depth = 1;
+			}
+			p->pIn = ecScanGroup(&p->skip, p->pIn, p->pInEnd);
+			if (p->skip.depth){
+				// group goes on in next block of input
+				if ((ch = ecFillInput(p)) == EOF)
+					break;
+				ecUngetc(p, ch);
+			}
+			else if ((ec = ecPopRtfState(p)) != ecOK)
+				return ec;
+			continue;
+		}
+		if ((ch = ecGetc(p)) == EOF)
+			break;
+		if (p->cGroup < 0)
+			return ecStackUnderflow;
+		if (p->ris == risBin) // if we're parsing binary data, 
+											 // handle it directly
+		{
+			if (p->rds == rdsPict){
+				// take binary picture data from the input buffer
+				const unsigned char *bin = p->pIn - 1;
+				size_t len = p->pInEnd - bin;
+				if (len > (size_t)p->cbBin)
+					len = p->cbBin;
+				p->pIn = bin + len;
+				p->cbBin -= len;
+				if (p->cbBin <= 0)
+					p->ris = risNorm;
+				if ((ec = ecAddPictureBin(p, bin, len)) != ecOK)
+					return ec;
+			}
+			else if ((ec = ecParseChar(p, ch)) != ecOK)
+				return ec;
+		}
+		else
+		{
+			switch (ch)
+			{
+				case '{':
+					if ((ec = ecPushRtfState(p)) != ecOK)
+						return ec;
+						break;
+				case '}':
+					if ((ec = ecPopRtfState(p)) != ecOK)
+						return ec;
+						break;
+				case '\\':
+					if ((ec = ecParseRtfKeyword(p)) != ecOK)
+						return ec;
+						break;
+				case 0x0d:
+				case 0x0a:  // cr and lf are noise characters...
+						break;
+				default:
+					if (p->ris == risNorm)
+					{
+						// take the whole run of plain chars right
+						// from the input buffer
+						const unsigned char *run = p->pIn - 1;
+						p->pIn = ecScanRun(p->pIn, p->pInEnd);
+						if ((ec = ecParseRun(p, run, p->pIn - run)) != ecOK)
+							return ec;
+					}
+					else {
+						if (p->ris != risHex)
+							return ecAssertion;
+
+						if (rghexRtf[ch] < 0)
+							return ecInvalidHex;
+						p->bHex = p->bHex << 4 | rghexRtf[ch];
+						p->cNibble--;
+						if (!p->cNibble)
+						{
+							if ((ec = ecParseByte(p, p->bHex)) != ecOK)
+								return ec;
+							p->cNibble = 2;
+							p->bHex = 0;
+							p->ris = risNorm;
+						}
+					}         // end else (ris != risNorm)
+					break;
+				}           // switch
+			}         // else (ris != risBin)
+		}							// while
+	return ecOK;
+}
+
+//
+// %%Function: ecRtfEndInput
+//
+// Flush text run at the end of input and check that all
+// groups are closed.
+//
+static int
+ecRtfEndInput(rtf_parser_t *p)
+{
+	if (p->lRun)
+		ecFlushRun(p);
+	if (p->fStop)
+		return ecOK;
+	if (p->cGroup < 0)
+		return ecStackUnderflow;
+	if (p->cGroup > 0)
+		return ecUnmatchedBrace;
+	return ecOK;
+}
+
+//
+// %%Function: ecRtfParseInput
+//
+// Parse whole input and check that all groups are closed.
+//
+static int
+ecRtfParseInput(rtf_parser_t *p)
+{
+	int ec = ecRtfParseBlock(p);
+	if (ec != ecOK)
+		return ec;
+	return ecRtfEndInput(p);
+}
+
+//
+// %%Function: rtf_parser_parse
+//
+// Parse RTF file. File is read by large blocks into
+// parser input buffer.
+//
+int rtf_parser_parse(
+		rtf_parser_t *p,
+		FILE *fp
+		)
+{
+	if (!p->bufIn){
+		p->bufIn = malloc(RTF_INBUFSIZ);
+		if (!p->bufIn)
+			return ecStackOverflow;
+	}
+	ecResetRtfState(p);
+	p->fpIn = fp;
+	p->pIn = p->pInEnd = p->bufIn;
+	return ecRtfParseInput(p);
+}
+
+//
+// %%Function: rtf_parser_parse_buffer
+//
+// Parse RTF document from memory buffer.
+//
+int rtf_parser_parse_buffer(
+		rtf_parser_t *p,
+		const char *buf,
+		size_t len
+		)
+{
+	ecResetRtfState(p);
+	p->fpIn = NULL;
+	p->pIn = (const unsigned char *)buf;
+	p->pInEnd = p->pIn + len;
+	return ecRtfParseInput(p);
+}
+
+//
+// %%Function: rtf_feed
+//
+// Parse next part of document. Control word cut by the
+// end of part is kept in carry buffer and parsed when
+// next part completes it; all other state (hex pair,
+// \bin count, \uc skip, group stack) lives in parser.
+//
+int rtf_feed(
+		rtf_parser_t *p,
+		const char *buf,
+		size_t len
+		)
+{
+	const unsigned char *s = (const unsigned char *)buf;
+	size_t n = 0, lcarry, used;
+	int ec;
+
+	if (!p->fPush){
+		ecResetRtfState(p);
+		p->fPush = fTrue;
+		p->fpIn = NULL;
+	}
+	if (p->ecPush != ecOK)
+		return p->ecPush;
+	if (p->fStop)
+		return ecOK;
+
+	if (p->carry.len){
+		// complete cut control word with chars up to its
+		// delimiter and parse it
+		lcarry = p->carry.len;
+		while (n < len && (isalnum(s[n]) || s[n] == '-'))
+			n++;
+		if (n < len)
+			n++;
+		if (str_append(&p->carry, buf, n))
+			return p->ecPush = ecStackOverflow;
+		p->pIn = (const unsigned char *)p->carry.str;
+		p->pInEnd = p->pIn + p->carry.len;
+		ec = ecRtfParseBlock(p);
+		ecKeepRun(p);
+		if (ec == ecMoreInput){
+			used = p->pIn - (const unsigned char *)p->carry.str;
+			if (used < lcarry){
+				// still cut - all of buf is taken
+				memmove(p->carry.str, p->carry.str + used, p->carry.len - used);
+				p->carry.len -= used;
+				return ecOK;
+			}
+			// next control word is cut - parse it from buf
+			n = used - lcarry;
+			ec = ecOK;
+		}
+		p->carry.len = 0;
+		if (ec != ecOK)
+			return p->ecPush = ec;
+	}
+
+	p->pIn = s + n;
+	p->pInEnd = s + len;
+	ec = ecRtfParseBlock(p);
+	if (ec == ecMoreInput){
+		ec = str_append(&p->carry, (const char *)p->pIn, p->pInEnd - p->pIn) ?
+			ecStackOverflow : ecOK;
+	}
+	// buf is not used after return
+	ecKeepRun(p);
+	p->pIn = p->pInEnd = NULL;
+	return p->ecPush = ec;
+}
+
+//
+// %%Function: rtf_finish
+//
+// End document given by rtf_feed: parse control word left
+// in carry buffer and check that all groups are closed.
+//
+int rtf_finish(
+		rtf_parser_t *p
+		)
+{
+	int ec = p->ecPush;
+	if (!p->fPush)
+		return ecOK;
+	p->fPush = fFalse;
+	p->ecPush = ecOK;
+	if (ec == ecOK && p->carry.len){
+		p->pIn = (const unsigned char *)p->carry.str;
+		p->pInEnd = p->pIn + p->carry.len;
+		ec = ecRtfParseBlock(p);
+	}
+	p->carry.len = 0;
+	p->pIn = p->pInEnd = NULL;
+	if (ec != ecOK)
+		return ec;
+	return ecRtfEndInput(p);
+}
+
+//
+// %%Function: ecRtfParseMapped
+//
+// Parse RTF file by path on nthreads threads. The file is
+// mapped into memory and parsed in place.
+//
+static int
+ecRtfParseMapped(
+		rtf_parser_t *p,
+		const char *path,
+		int nthreads
+		)
+{
+	int ec;
+#ifdef _WIN32
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return ecOpenFile;
+	ec = rtf_parser_parse(p, fp);
+	fclose(fp);
+#else
+	struct stat st;
+	void *map;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return ecOpenFile;
+	if (fstat(fd, &st)){
+		close(fd);
+		return ecOpenFile;
+	}
+	if (st.st_size == 0){
+		close(fd);
+		return rtf_parser_parse_buffer(p, "", 0);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return ecOpenFile;
+#ifdef MADV_SEQUENTIAL
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+	ec = rtf_parser_parse_buffer_parallel(p, map, st.st_size, nthreads);
+	munmap(map, st.st_size);
+#endif
+	return ec;
+}
+
+//
+// %%Function: rtf_parser_parse_file
+//
+// Parse RTF file by path. The file is mapped into memory
+// and parsed in place.
+//
+int rtf_parser_parse_file(
+		rtf_parser_t *p,
+		const char *path
+		)
+{
+	return ecRtfParseMapped(p, path, 1);
+}
+
+//
+// %%Function: rtf_parser_parse_file_parallel
+//
+// Parse RTF file by path on nthreads threads.
+//
+int rtf_parser_parse_file_parallel(
+		rtf_parser_t *p,
+		const char *path,
+		int nthreads
+		)
+{
+	return ecRtfParseMapped(p, path, nthreads);
+}
+
+//
+// %%Function: ecRtfParse
+//
+// Parse RTF file with temporary parser context.
+//
+int ecRtfParse(
+		FILE *fp,
+		prop_t *prop,
+		rnotify_t *no
+		)
+{
+	int ec;
+	rtf_parser_t *p = rtf_parser_create(prop, no);
+	if (!p)
+		return ecStackOverflow;
+	ec = rtf_parser_parse(p, fp);
+	rtf_parser_destroy(p);
+	return ec;
+}
+
+//
+// %%Function: ecRtfParseFile
+//
+// Parse RTF file by path with temporary parser context.
+//
+int ecRtfParseFile(
+		const char *path,
+		prop_t *prop,
+		rnotify_t *no
+		)
+{
+	int ec;
+	rtf_parser_t *p = rtf_parser_create(prop, no);
+	if (!p)
+		return ecStackOverflow;
+	ec = rtf_parser_parse_file(p, path);
+	rtf_parser_destroy(p);
+	return ec;
+}
+
+//
+// %%Function: ecRtfParseBuffer
+//
+// Parse RTF document from memory buffer with temporary
+// parser context.
+//
+int ecRtfParseBuffer(
+		const char *buf,
+		size_t len,
+		prop_t *prop,
+		rnotify_t *no
+		)
+{
+	int ec;
+	rtf_parser_t *p = rtf_parser_create(prop, no);
+	if (!p)
+		return ecStackOverflow;
+	ec = rtf_parser_parse_buffer(p, buf, len);
+	rtf_parser_destroy(p);
+	return ec;
+}
+
+//
+// TEXT EXTRACTION
+//
+// Fast path for plain text of document: no props, styles
+// or tables are kept, only the \uc value of every group.
+// Destinations (font table, stylesheet, info, pictures,
+// headers, footnotes, unknown \* groups...) are skipped by
+// ecScanGroup without parsing them.
+//
+
+// text extraction state
+typedef struct textst {
+	struct str out;              // text
+	int *ucs;                    // \uc of outer groups
+	int  sucs;                   // allocated size of ucs
+	int  depth;                  // open groups
+	int  uc;                     // \uc of current group
+	long skip;                   // fallback chars of \u to skip
+	int  high;                   // pending high surrogate
+	bool fSkipDestIfUnk;         // after \*
+	const CPGTAB *cpg;           // code page of \'xx (\ansicpg)
+} TEXTST;
+
+//
+// %%Function: ecTextKeyword
+//
+// Read control word (without '\\') at s into szKeyword (cut
+// if it is too long) and its parameter. Return position
+// after it and its delimiting space.
+//
+static const unsigned char *
+ecTextKeyword(const unsigned char *s, const unsigned char *end,
+		char szKeyword[30], long *param, bool *fParam)
+{
+	size_t l = 0;
+	bool fNeg = fFalse;
+	*param = 0;
+	*fParam = fFalse;
+	if (s == end){
+		szKeyword[0] = 0;
+		return s;
+	}
+	if (!isalpha(*s)){
+		// control symbol
+		szKeyword[0] = *s++;
+		szKeyword[1] = 0;
+		return s;
+	}
+	while (s < end && isalpha(*s)){
+		if (l < 29)
+			szKeyword[l++] = *s;
+		s++;
+	}
+	szKeyword[l] = 0;
+	if (s < end && *s == '-'){
+		fNeg = fTrue;
+		s++;
+	}
+	if (s < end && isdigit(*s)){
+		*fParam = fTrue;
+		l = 0;
+		for (; s < end && isdigit(*s); s++)
+			if (l++ < 10)
+				*param = *param * 10 + *s - '0';
+		if (fNeg)
+			*param = -*param;
+	}
+	if (s < end && *s == ' ')
+		s++;
+	return s;
+}
+
+//
+// %%Function: ecTextPush
+//
+// Open group - save \uc of outer group.
+//
+static int
+ecTextPush(TEXTST *t)
+{
+	if (t->depth == t->sucs){
+		int sucs = t->sucs ? t->sucs * 2 : 32;
+		void *ptr = realloc(t->ucs, sucs * sizeof(int));
+		if (!ptr)
+			return ecStackOverflow;
+		t->ucs = ptr;
+		t->sucs = sucs;
+	}
+	t->ucs[t->depth++] = t->uc;
+	t->skip = 0;
+	return ecOK;
+}
+
+//
+// %%Function: ecTextPop
+//
+// Close group - restore \uc of outer group.
+//
+static int
+ecTextPop(TEXTST *t)
+{
+	if (!t->depth)
+		return ecStackUnderflow;
+	t->uc = t->ucs[--t->depth];
+	t->skip = 0;
+	return ecOK;
+}
+
+//
+// %%Function: ecTextUTF
+//
+// Append unicode char of \u (with pair of surrogates for
+// chars above U+FFFF) and start skipping its fallback.
+//
+static int
+ecTextUTF(TEXTST *t, long ch)
+{
+	char s[6];
+	int err = 0;
+	if (ch < 0)
+		ch += 65536;
+	t->skip = t->uc;
+	if (ch >= 0xD800 && ch < 0xDC00){
+		t->high = ch;
+		return ecOK;
+	}
+	if (ch >= 0xDC00 && ch < 0xE000)
+		ch = t->high ? 
+			0x10000 + ((t->high - 0xD800) << 10) + (ch - 0xDC00) : 0xFFFD;
+	else if (t->high)
+		err = str_append(&t->out, s, c32tomb(s, 0xFFFD));
+	t->high = 0;
+	if (err || str_append(&t->out, s, c32tomb(s, ch)))
+		return ecStackOverflow;
+	return ecOK;
+}
+
+//
+// %%Function: ecTextChar
+//
+// Append char of control word: command chars end
+// paragraph ('\n') or cell ('\t').
+//
+static int
+ecTextChar(TEXTST *t, int ch)
+{
+	char c = ch;
+	switch (ch) {
+		case PAR:
+		case SECT:
+		case ROW:
+			c = '\n';
+			break;
+		case CELL:
+			c = '\t';
+			break;
+		default:
+			if (ch > 255)
+				return ecOK;
+			break;
+	}
+	return str_append(&t->out, &c, 1) ? ecStackOverflow : ecOK;
+}
+
+//
+// %%Function: ecTextRun
+//
+// Append run of plain chars - 8-bit chars of code page
+// as UTF-8.
+//
+static int
+ecTextRun(TEXTST *t, const unsigned char *s, const unsigned char *end)
+{
+	char u[6];
+	while (s < end) {
+		const unsigned char *e = ecScanAscii(s, end);
+		if (str_append(&t->out, (const char *)s, e - s))
+			return ecStackOverflow;
+		if (e < end && str_append(&t->out, u, 
+					c32tomb(u, t->cpg->rgch[*e++ - 0x80])))
+			return ecStackOverflow;
+		s = e;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: ecTextHex
+//
+// Append char of \'xx. Like ecRtfParseBlock, CR and LF
+// between digits are skipped and braces or '\\' end it.
+//
+static const unsigned char *
+ecTextHex(TEXTST *t, const unsigned char *s, 
+		const unsigned char *end, int *ec)
+{
+	int b = 0, n = 0;
+	while (n < 2 && s < end) {
+		int ch = *s;
+		if (ch == 0x0d || ch == 0x0a){
+			s++;
+			continue;
+		}
+		if (ch == '{' || ch == '}' || ch == '\\')
+			return s;
+		if (rghexRtf[ch] < 0){
+			*ec = ecInvalidHex;
+			return s;
+		}
+		b = b << 4 | rghexRtf[ch];
+		n++;
+		s++;
+	}
+	if (n < 2)
+		return s;
+	if (t->skip > 0)
+		t->skip--;
+	else {
+		unsigned char c = b;
+		*ec = ecTextRun(t, &c, &c + 1);
+	}
+	return s;
+}
+
+//
+// %%Function: ecTextSkipGroup
+//
+// Skip the rest of current group and close it.
+//
+static const unsigned char *
+ecTextSkipGroup(TEXTST *t, const unsigned char *s, 
+		const unsigned char *end, int *ec)
+{
+	BRSCAN b;
+	memset(&b, 0, sizeof(b));
+	b.depth = 1;
+	s = ecScanGroup(&b, s, end);
+	*ec = b.depth ? ecUnmatchedBrace : ecTextPop(t);
+	return s;
+}
+
+//
+// %%Function: ecRtfText
+//
+// Extract plain UTF-8 text of document in memory buffer.
+//
+int ecRtfText(
+		const char *buf,
+		size_t len,
+		char **text,
+		size_t *ltext
+		)
+{
+	const unsigned char *s = (const unsigned char *)buf, 
+				*end = s + len, *run;
+	char szKeyword[30];
+	long param;
+	bool fParam;
+	int ec = ecOK, isym;
+	TEXTST t;
+
+	memset(&t, 0, sizeof(t));
+	t.uc = 1;
+	t.cpg = cpg_table(1252);
+	*text = NULL;
+	*ltext = 0;
+	if (str_init(&t.out, len / 2 + 1))
+		return ecStackOverflow;
+
+	while (ec == ecOK && s < end) {
+		int ch = *s++;
+		switch (ch) {
+			case '{':
+				ec = ecTextPush(&t);
+				break;
+			case '}':
+				ec = ecTextPop(&t);
+				break;
+			case 0x0d:
+			case 0x0a:
+				break;
+			case '\\':
+				s = ecTextKeyword(s, end, szKeyword, &param, &fParam);
+				if (!szKeyword[0]){
+					ec = ecEndOfFile;
+					break;
+				}
+				isym = ecLookupKeyword(szKeyword);
+				if (t.skip > 0 && szKeyword[0] != '\''){
+					// control word is one fallback char of \u
+					t.skip--;
+					if (isym >= 0 && rgsymRtf[isym].kwd == kwdSpec &&
+							rgsymRtf[isym].idx == ipfnBin && param > 0)
+						s += (size_t)param < (size_t)(end - s) ? 
+							(size_t)param : (size_t)(end - s);
+					break;
+				}
+				if (isym < 0){
+					if (t.fSkipDestIfUnk)
+						s = ecTextSkipGroup(&t, s, end, &ec);
+					t.fSkipDestIfUnk = fFalse;
+					break;
+				}
+				t.fSkipDestIfUnk = fFalse;
+				switch (rgsymRtf[isym].kwd) {
+					case kwdChar:
+						ec = ecTextChar(&t, rgsymRtf[isym].idx);
+						break;
+					case kwdDest:
+						// no body text in destinations
+						s = ecTextSkipGroup(&t, s, end, &ec);
+						break;
+					case kwdUTF:
+						ec = ecTextUTF(&t, param);
+						break;
+					case kwdSpec:
+						switch (rgsymRtf[isym].idx) {
+							case ipfnSkipDest:
+								t.fSkipDestIfUnk = fTrue;
+								break;
+							case ipfnUc:
+								t.uc = param > 0 ? param : 0;
+								break;
+							case ipfnAnsicpg:
+								t.cpg = cpg_table(param);
+								break;
+							case ipfnBin:
+								if (param > 0)
+									s += (size_t)param < (size_t)(end - s) ? 
+										(size_t)param : (size_t)(end - s);
+								break;
+							case ipfnHex:
+								s = ecTextHex(&t, s, end, &ec);
+								break;
+						}
+						break;
+					default:
+						break;
+				}
+				break;
+			default:
+				// run of plain chars
+				run = s - 1;
+				s = ecScanRun(s, end);
+				if (t.skip > 0){
+					size_t n = s - run;
+					if (n > (size_t)t.skip)
+						n = t.skip;
+					run += n;
+					t.skip -= n;
+				}
+				ec = ecTextRun(&t, run, s);
+				break;
+		}
+	}
+	if (ec == ecOK && t.depth)
+		ec = ecUnmatchedBrace;
+	free(t.ucs);
+	if (ec != ecOK){
+		free(t.out.str);
+		return ec;
+	}
+	*text = t.out.str;
+	*ltext = t.out.len;
+	return ecOK;
+}
+
+//
+// PARALLEL PARSING
+//
+// Document is split at top level \par and \sect keywords
+// found by fast brace-depth pre-scan. The header (font
+// table, stylesheet...) is parsed here, then chunks are
+// parsed by threads, each started from the state at the
+// end of the header, and their callbacks are recorded.
+// Chunks are taken in order: if the real state at the start
+// of chunk gives the same result (props not touched in
+// chunk or reset there before use may differ), recorded
+// callbacks are replayed, else the chunk is parsed again
+// right here. So callbacks are called from this thread in
+// the same order and with the same data as serial parsing
+// does.
+//
+
+#if !defined(_WIN32) && !defined(RTF_NO_THREADS)
+
+// don't split documents into chunks smaller than this
+#ifndef RTF_PAR_MINCHUNK
+#define RTF_PAR_MINCHUNK 1048576
+#endif
+
+// recorded callbacks
+typedef enum {
+	evCommand,
+	evFont,
+	evInfo,
+	evDate,
+	evStyle,
+	evColor,
+	evChar,
+	evText,
+	evPict,
+	evPictBegin,
+	evPictChunk,
+	evPictEnd,
+} EV;
+
+typedef struct event {
+	EV ev;
+	bool fProp;                  // prop_t follows event
+	int fTouched;                // props touched in chunk before event
+	int a, b;                    // int arguments of callback
+	size_t len;                  // length of data after prop_t
+} EVENT;
+
+// chunk of document parsed by thread
+typedef struct chunk {
+	size_t start, end;           // input range
+	rtf_parser_t *p;             // chunk parser (state at the end)
+	prop_t prop;                 // props of chunk parser
+	prop_t last;                 // props of last recorded event
+	int fTouched;                // props touched before last event
+	bool fFirst;                 // no props recorded yet
+	rnotify_t no;                // callbacks to record events
+	struct str log;              // recorded events
+	bool fLost;                  // event is not recorded
+	int ec;
+	bool fDone;
+} CHUNK;
+
+typedef struct split {
+	const unsigned char *buf;
+	CHUNK *chunks;
+	int nchunks;
+	int next;                    // next chunk to parse
+	bool fStop;
+	rtf_parser_t *seed;          // state to start chunks with
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} SPLIT;
+
+//
+// %%Function: ecSplitRtf
+//
+// Pre-scan document the way ecRtfParseBlock reads it and
+// split it after top level \par and \sect keywords: header
+// is parsed up to the first of them, chunks after it are
+// about len/nchunks bytes. Return number of chunks after
+// the header (at most max).
+//
+static int
+ecSplitRtf(const unsigned char *s, size_t len, int nchunks,
+		CHUNK *chunks, int max)
+{
+	size_t i = 0, kw, lkw, step = len / nchunks, target = 0;
+	long param;
+	bool fNeg;
+	int depth = 0, n = -1;
+
+	while (i < len) {
+		int ch;
+		i = ecScanRun(s + i, s + len) - s;
+		if (i == len)
+			break;
+		ch = s[i++];
+		if (ch == '{'){
+			depth++;
+			continue;
+		}
+		if (ch == '}'){
+			depth--;
+			continue;
+		}
+		if (ch != '\\' || i == len)
+			continue;
+		if (!isalpha(s[i])){
+			// control symbol
+			i++;
+			continue;
+		}
+
+		// control word
+		kw = i;
+		while (i < len && isalpha(s[i]))
+			i++;
+		lkw = i - kw;
+		fNeg = i < len && s[i] == '-';
+		if (fNeg)
+			i++;
+		param = 0;
+		while (i < len && isdigit(s[i])) {
+			if (param < 100000000)
+				param = param * 10 + s[i] - '0';
+			i++;
+		}
+		if (i < len && s[i] == ' ')
+			i++;
+
+		if (lkw == 3 && memcmp(s + kw, "bin", 3) == 0){
+			// skip binary data
+			if (!fNeg && param > 0)
+				i += (size_t)param < len - i ? (size_t)param : len - i;
+			continue;
+		}
+		if (depth != 1 || i < target || i == len ||
+				!((lkw == 3 && memcmp(s + kw, "par", 3) == 0) ||
+					(lkw == 4 && memcmp(s + kw, "sect", 4) == 0)))
+			continue;
+
+		if (n + 1 == max)
+			break;
+		if (n >= 0)
+			chunks[n].end = i;
+		n++;
+		chunks[n].start = i;
+		target = i + step;
+	}
+	if (n >= 0)
+		chunks[n].end = len;
+	return n + 1;
+}
+
+//
+// %%Function: ecCopyRtfState
+//
+// Copy parser state (group stack, props, tables, pending
+// text run) from src to dst. Picture data is moved.
+//
+static int
+ecCopyRtfState(rtf_parser_t *dst, rtf_parser_t *src)
+{
+	if (dst->sstack < src->cGroup){
+		void *ptr = realloc(dst->stack, src->sstack * sizeof(SAVE));
+		if (!ptr)
+			return ecStackOverflow;
+		dst->stack = ptr;
+		dst->sstack = src->sstack;
+	}
+	if (src->cGroup > 0)
+		memcpy(dst->stack, src->stack, src->cGroup * sizeof(SAVE));
+	if (ecCopyStyles(dst, src) != ecOK)
+		return ecStackOverflow;
+	dst->cGroup = src->cGroup;
+	dst->fSkipDestIfUnk = src->fSkipDestIfUnk;
+	dst->uc = src->uc;
+	dst->cUcSkip = src->cUcSkip;
+	dst->ucHigh = src->ucHigh;
+	dst->skip = src->skip;
+	dst->fWant = src->fWant;
+	dst->fStop = src->fStop;
+	dst->cbBin = src->cbBin;
+	dst->lParam = src->lParam;
+	dst->rds = src->rds;
+	dst->ris = src->ris;
+	dst->cNibble = src->cNibble;
+	dst->bHex = src->bHex;
+	dst->cpg = src->cpg;
+	dst->fnt = src->fnt;
+	dst->col = src->col;
+
+	dst->sRun = src->sRun;
+	dst->lRun = src->lRun;
+	if (src->pRun == src->run){
+		memcpy(dst->run, src->run, src->lRun);
+		dst->pRun = dst->run;
+	} else
+		dst->pRun = src->pRun;
+
+	dst->pict = src->pict;
+	dst->pictNibble = src->pictNibble;
+	dst->fPictBegun = src->fPictBegun;
+	dst->pictSent = src->pictSent;
+	dst->pictDrop = src->pictDrop;
+	if (src->img.str || dst->img.str){
+		free(dst->img.str);
+		dst->img = src->img;
+		src->img.str = NULL;
+	}
+
+	*dst->prop = *src->prop;
+	memcpy(dst->info, src->info, src->linfo);
+	dst->linfo = src->linfo;
+	dst->tinfo = src->tinfo;
+	dst->date = src->date;
+	dst->tdate = src->tdate;
+	return ecOK;
+}
+
+//
+// %%Function: ecSameRtfState
+//
+// True if parsing from state a and state b gives the same
+// result of chunk parsed from state b. Saved props of
+// first keep group levels (they are not closed in chunk)
+// are not compared - values of a are put back by
+// ecKeepSaved, so props saved in b must be saved in a too.
+// Props not touched in chunk are not compared - values of
+// a are put to recorded props by ecReplay. Props reset in
+// chunk are not compared either.
+//
+static bool
+ecSameRtfState(const rtf_parser_t *a, const rtf_parser_t *b,
+		int keep, int touched, int reset)
+{
+	int i, n;
+	if (a->cGroup != b->cGroup || a->cGroup < 1 ||
+			a->rds != b->rds || a->ris != b->ris ||
+			a->rds == rdsPict || a->img.str || b->img.str ||
+			a->fSkipDestIfUnk != b->fSkipDestIfUnk ||
+			a->cbBin != b->cbBin || 
+			a->cNibble != b->cNibble || a->bHex != b->bHex ||
+			a->cpg != b->cpg ||
+			a->uc != b->uc || a->cUcSkip != b->cUcSkip ||
+			a->ucHigh != b->ucHigh ||
+			a->skip.depth != b->skip.depth || a->skip.st != b->skip.st ||
+			a->skip.lbin != b->skip.lbin || a->skip.fNeg != b->skip.fNeg ||
+			a->skip.param != b->skip.param || a->skip.cbBin != b->skip.cbBin ||
+			a->lRun || b->lRun ||
+			a->nstyles != b->nstyles || a->nstylesCb != b->nstylesCb ||
+			(a->sstyles > a->nstyles) != (b->sstyles > b->nstyles) ||
+			a->linfo != b->linfo || a->tinfo != b->tinfo ||
+			a->tdate != b->tdate)
+		return fFalse;
+
+	// with entry being parsed
+	n = a->sstyles > a->nstyles ? a->nstyles + 1 : a->nstyles;
+	if (memcmp(&a->fnt, &b->fnt, sizeof(FONT)) ||
+			memcmp(&a->col, &b->col, sizeof(COLOR)) ||
+			memcmp(&a->date, &b->date, sizeof(DATE)) ||
+			memcmp(a->info, b->info, a->linfo) ||
+			(n && memcmp(a->stylesheet, b->stylesheet, n * sizeof(STYLEDEF))))
+		return fFalse;
+
+	for (i = 0; i < a->cGroup; ++i) {
+		const SAVE *sa = &a->stack[i], *sb = &b->stack[i];
+		if (sa->rds != sb->rds || sa->ris != sb->ris || sa->uc != sb->uc)
+			return fFalse;
+		if (i < keep){
+			if (sb->fSaved & ~sa->fSaved)
+				return fFalse;
+			continue;
+		}
+		if (sa->fSaved != sb->fSaved)
+			return fFalse;
+		if (((sa->fSaved & (1 << propChp)) && 
+					memcmp(&sa->chp, &sb->chp, sizeof(CHP))) ||
+				((sa->fSaved & (1 << propPap)) && 
+					memcmp(&sa->pap, &sb->pap, sizeof(PAP))) ||
+				((sa->fSaved & (1 << propSep)) && 
+					memcmp(&sa->sep, &sb->sep, sizeof(SEP))) ||
+				((sa->fSaved & (1 << propDop)) && 
+					memcmp(&sa->dop, &sb->dop, sizeof(DOP))) ||
+				((sa->fSaved & (1 << propTrp)) && 
+					memcmp(&sa->trp, &sb->trp, sizeof(TRP))) ||
+				((sa->fSaved & (1 << propTcp)) && 
+					memcmp(&sa->tcp, &sb->tcp, sizeof(TCP))))
+			return fFalse;
+	}
+
+	// reset of prop saves it to group stack, if it is
+	// not saved yet - then its value is used, if the
+	// group is closed in chunk
+	if (keep < a->cGroup)
+		reset &= a->stack[a->cGroup - 1].fSaved;
+	reset |= ~touched;
+	if ((!(reset & (1 << propChp)) && 
+				memcmp(&a->prop->chp, &b->prop->chp, sizeof(CHP))) ||
+			(!(reset & (1 << propPap)) && 
+				memcmp(&a->prop->pap, &b->prop->pap, sizeof(PAP))) ||
+			(!(reset & (1 << propSep)) && 
+				memcmp(&a->prop->sep, &b->prop->sep, sizeof(SEP))) ||
+			(!(reset & (1 << propDop)) && 
+				memcmp(&a->prop->dop, &b->prop->dop, sizeof(DOP))) ||
+			(!(reset & (1 << propTrp)) && 
+				memcmp(&a->prop->trp, &b->prop->trp, sizeof(TRP))) ||
+			(!(reset & (1 << propTcp)) && 
+				memcmp(&a->prop->tcp, &b->prop->tcp, sizeof(TCP))))
+		return fFalse;
+	return fTrue;
+}
+
+//
+// %%Function: ecSetProps
+//
+// Copy props of mask from src to dst.
+//
+static void
+ecSetProps(prop_t *dst, const prop_t *src, int mask)
+{
+	if (mask & (1 << propChp))
+		dst->chp = src->chp;
+	if (mask & (1 << propPap))
+		dst->pap = src->pap;
+	if (mask & (1 << propSep))
+		dst->sep = src->sep;
+	if (mask & (1 << propDop))
+		dst->dop = src->dop;
+	if (mask & (1 << propTrp))
+		dst->trp = src->trp;
+	if (mask & (1 << propTcp))
+		dst->tcp = src->tcp;
+}
+
+//
+// %%Function: ecCopySaved
+//
+// Copy props of mask from prop to save.
+//
+static void
+ecCopySaved(SAVE *save, const prop_t *prop, int mask)
+{
+	if (mask & (1 << propChp))
+		save->chp = prop->chp;
+	if (mask & (1 << propPap))
+		save->pap = prop->pap;
+	if (mask & (1 << propSep))
+		save->sep = prop->sep;
+	if (mask & (1 << propDop))
+		save->dop = prop->dop;
+	if (mask & (1 << propTrp))
+		save->trp = prop->trp;
+	if (mask & (1 << propTcp))
+		save->tcp = prop->tcp;
+	save->fSaved |= mask;
+}
+
+//
+// %%Function: ecKeepSaved
+//
+// Put props saved in first keep group levels of src to
+// group stack of dst. Props saved in chunk on the top
+// level of src are props of src before chunk (start).
+//
+static void
+ecKeepSaved(rtf_parser_t *dst, const rtf_parser_t *src, int keep,
+		const prop_t *start)
+{
+	int i;
+	for (i = 0; i < keep; ++i) {
+		const SAVE *s = &src->stack[i];
+		SAVE *d = &dst->stack[i];
+		if (i == src->cGroup - 1)
+			ecCopySaved(d, start, d->fSaved & ~s->fSaved);
+		d->fSaved |= s->fSaved;
+		if (s->fSaved & (1 << propChp))
+			d->chp = s->chp;
+		if (s->fSaved & (1 << propPap))
+			d->pap = s->pap;
+		if (s->fSaved & (1 << propSep))
+			d->sep = s->sep;
+		if (s->fSaved & (1 << propDop))
+			d->dop = s->dop;
+		if (s->fSaved & (1 << propTrp))
+			d->trp = s->trp;
+		if (s->fSaved & (1 << propTcp))
+			d->tcp = s->tcp;
+	}
+}
+
+//
+// %%Function: ecRecord
+//
+// Add callback event to chunk log. Props are recorded only
+// when they (or props touched in chunk) differ from props
+// of last event.
+//
+static void
+ecRecord(CHUNK *c, EV ev, const prop_t *prop, int a, int b,
+		const void *data, size_t len, const void *data2, size_t len2)
+{
+	EVENT e;
+	memset(&e, 0, sizeof(e));
+	e.ev = ev;
+	e.a = a;
+	e.b = b;
+	e.len = len + len2;
+	e.fTouched = c->p->fTouched;
+	e.fProp = prop && (c->fFirst || e.fTouched != c->fTouched ||
+			memcmp(prop, &c->last, sizeof(prop_t)));
+	if (e.fProp){
+		c->last = *prop;
+		c->fTouched = e.fTouched;
+		c->fFirst = fFalse;
+	}
+	if (str_append(&c->log, (const char *)&e, sizeof(e)) ||
+			(e.fProp && str_append(&c->log, (const char *)prop, sizeof(prop_t))) ||
+			str_append(&c->log, (const char *)data, len) ||
+			str_append(&c->log, (const char *)data2, len2))
+		c->fLost = fTrue;
+}
+
+static int
+ecRecCommand(void *udata, const char *s, int param, char fParam)
+{
+	ecRecord(udata, evCommand, NULL, param, fParam, s, strlen(s) + 1, NULL, 0);
+	return 0;
+}
+
+static int
+ecRecFont(void *udata, FONT *f)
+{
+	ecRecord(udata, evFont, NULL, 0, 0, f, sizeof(FONT), NULL, 0);
+	return 0;
+}
+
+static int
+ecRecInfo(void *udata, tINFO t, const char *s)
+{
+	ecRecord(udata, evInfo, NULL, t, 0, s, strlen(s) + 1, NULL, 0);
+	return 0;
+}
+
+static int
+ecRecDate(void *udata, tDATE t, DATE *d)
+{
+	ecRecord(udata, evDate, NULL, t, 0, d, sizeof(DATE), NULL, 0);
+	return 0;
+}
+
+static int
+ecRecStyle(void *udata, STYLE *s)
+{
+	ecRecord(udata, evStyle, NULL, 0, 0, s, sizeof(STYLE), NULL, 0);
+	return 0;
+}
+
+static int
+ecRecColor(void *udata, COLOR *c)
+{
+	ecRecord(udata, evColor, NULL, 0, 0, c, sizeof(COLOR), NULL, 0);
+	return 0;
+}
+
+static int
+ecRecChar(void *udata, STREAM s, prop_t *p, int ch)
+{
+	ecRecord(udata, evChar, p, s, ch, NULL, 0, NULL, 0);
+	return 0;
+}
+
+static int
+ecRecText(void *udata, STREAM s, const prop_t *p, 
+		const char *utf8, size_t len)
+{
+	ecRecord(udata, evText, p, s, 0, utf8, len, NULL, 0);
+	return 0;
+}
+
+static int
+ecRecPict(void *udata, prop_t *p, PICT *pict)
+{
+	ecRecord(udata, evPict, p, 0, 0, pict, sizeof(PICT), 
+			pict->data, pict->len);
+	return 0;
+}
+
+static int
+ecRecPictBegin(void *udata, prop_t *p, PICT *pict)
+{
+	ecRecord(udata, evPictBegin, p, 0, 0, pict, sizeof(PICT), NULL, 0);
+	return 0;
+}
+
+static int
+ecRecPictChunk(void *udata, PICT *pict, 
+		const unsigned char *data, size_t len)
+{
+	ecRecord(udata, evPictChunk, NULL, 0, 0, pict, sizeof(PICT), data, len);
+	return 0;
+}
+
+static int
+ecRecPictEnd(void *udata, prop_t *p, PICT *pict, size_t len)
+{
+	ecRecord(udata, evPictEnd, p, 0, 0, pict, sizeof(PICT), &len, sizeof(len));
+	return 0;
+}
+
+//
+// %%Function: ecReplay
+//
+// Call callbacks recorded in chunk log.
+//
+static void
+ecReplay(rtf_parser_t *p, CHUNK *c)
+{
+	const char *s = c->log.str, *end = s + c->log.len;
+	const unsigned char *data = NULL;   // data of last pict_cb
+	rnotify_t *no = p->no;
+	size_t size;
+	EVENT e;
+	prop_t prop;
+	union {
+		FONT f;
+		DATE d;
+		STYLE s;
+		COLOR c;
+		PICT pict;
+	} u;
+
+	while (s < end) {
+		memcpy(&e, s, sizeof(e));
+		s += sizeof(e);
+		if (e.fProp){
+			// props not touched in chunk are props of p
+			memcpy(&prop, s, sizeof(prop_t));
+			ecSetProps(p->prop, &prop, e.fTouched);
+			s += sizeof(prop_t);
+		}
+		if (e.ev >= evPict){
+			memcpy(&u.pict, s, sizeof(PICT));
+			if (e.ev == evPict)
+				data = (const unsigned char *)s + sizeof(PICT);
+			u.pict.data = u.pict.data ? (unsigned char *)data : NULL;
+		}
+		switch (e.ev) {
+			case evCommand:
+				no->command_cb(no->udata, s, e.a, e.b);
+				break;
+			case evFont:
+				memcpy(&u.f, s, sizeof(FONT));
+				no->font_cb(no->udata, &u.f);
+				break;
+			case evInfo:
+				no->info_cb(no->udata, e.a, s);
+				break;
+			case evDate:
+				memcpy(&u.d, s, sizeof(DATE));
+				no->date_cb(no->udata, e.a, &u.d);
+				break;
+			case evStyle:
+				memcpy(&u.s, s, sizeof(STYLE));
+				no->style_cb(no->udata, &u.s);
+				break;
+			case evColor:
+				memcpy(&u.c, s, sizeof(COLOR));
+				no->color_cb(no->udata, &u.c);
+				break;
+			case evChar:
+				no->char_cb(no->udata, e.a, p->prop, e.b);
+				break;
+			case evText:
+				// ids are of main parser, not of chunk parser
+				if (no->run_cb)
+					no->run_cb(no->udata, e.a, rtf_parser_chp_id(p),
+							rtf_parser_pap_id(p), s, e.len);
+				else
+					no->text_cb(no->udata, e.a, p->prop, s, e.len);
+				break;
+			case evPict:
+				no->pict_cb(no->udata, p->prop, &u.pict);
+				break;
+			case evPictBegin:
+				no->pict_begin_cb(no->udata, p->prop, &u.pict);
+				break;
+			case evPictChunk:
+				no->pict_chunk_cb(no->udata, &u.pict, 
+						(const unsigned char *)s + sizeof(PICT),
+						e.len - sizeof(PICT));
+				break;
+			case evPictEnd:
+				memcpy(&size, s + sizeof(PICT), sizeof(size));
+				no->pict_end_cb(no->udata, p->prop, &u.pict, size);
+				break;
+		}
+		s += e.len;
+	}
+}
+
+//
+// %%Function: ecParseChunk
+//
+// Parse chunk from seed state and record callbacks.
+//
+static void
+ecParseChunk(SPLIT *sp, CHUNK *c)
+{
+	c->p = rtf_parser_create(&c->prop, &c->no);
+	if (!c->p || str_init(&c->log, BUFSIZ) ||
+			ecCopyRtfState(c->p, sp->seed) != ecOK)
+	{
+		c->fLost = fTrue;
+		return;
+	}
+	c->p->cGroupMin = c->p->cGroup;
+	c->p->fTouched = 0;
+	c->p->fReset = 0;
+	c->fFirst = fTrue;
+	c->p->fpIn = NULL;
+	c->p->pIn = sp->buf + c->start;
+	c->p->pInEnd = sp->buf + c->end;
+	c->ec = ecRtfParseBlock(c->p);
+}
+
+//
+// %%Function: ecParseChunks
+//
+// Thread function - parse chunks one by one.
+//
+static void *
+ecParseChunks(void *arg)
+{
+	SPLIT *sp = arg;
+	int i;
+	for (;;) {
+		pthread_mutex_lock(&sp->lock);
+		i = sp->fStop ? sp->nchunks : sp->next++;
+		pthread_mutex_unlock(&sp->lock);
+		if (i >= sp->nchunks)
+			break;
+		ecParseChunk(sp, &sp->chunks[i]);
+		pthread_mutex_lock(&sp->lock);
+		sp->chunks[i].fDone = fTrue;
+		pthread_cond_broadcast(&sp->cond);
+		pthread_mutex_unlock(&sp->lock);
+	}
+	return NULL;
+}
+
+//
+// %%Function: rtf_parser_parse_buffer_parallel
+//
+// Parse RTF document from memory buffer by chunks on
+// nthreads threads.
+//
+int rtf_parser_parse_buffer_parallel(
+		rtf_parser_t *p,
+		const char *buf,
+		size_t len,
+		int nthreads
+		)
+{
+	SPLIT sp;
+	pthread_t *threads = NULL;
+	prop_t prop, start;
+	int ec, i, n, nthr = 0;
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	n = nthreads * 4;
+	if ((size_t)n > len / RTF_PAR_MINCHUNK)
+		n = len / RTF_PAR_MINCHUNK;
+	if (nthreads < 2 || n < 2)
+		return rtf_parser_parse_buffer(p, buf, len);
+
+	memset(&sp, 0, sizeof(sp));
+	sp.buf = (const unsigned char *)buf;
+	sp.chunks = calloc(n + 2, sizeof(CHUNK));
+	if (!sp.chunks)
+		return rtf_parser_parse_buffer(p, buf, len);
+	sp.nchunks = ecSplitRtf(sp.buf, len, n, sp.chunks, n + 2);
+
+	// first chunk - document header
+	ecResetRtfState(p);
+	p->fpIn = NULL;
+	p->pIn = sp.buf;
+	p->pInEnd = sp.buf + (sp.nchunks > 0 ? sp.chunks[0].start : len);
+	ec = ecRtfParseBlock(p);
+	
+	if (ec == ecOK && sp.nchunks > 1 && p->rds != rdsPict && !p->img.str &&
+			!p->fStop)
+		sp.seed = rtf_parser_create(&prop, p->no);
+	if (sp.seed && ecCopyRtfState(sp.seed, p) == ecOK)
+		threads = malloc(nthreads * sizeof(pthread_t));
+	if (!threads){
+		// parse the rest here
+		free(sp.chunks);
+		rtf_parser_destroy(sp.seed);
+		if (ec != ecOK)
+			return ec;
+		p->pInEnd = sp.buf + len;
+		return ecRtfParseInput(p);
+	}
+
+	// record only callbacks that are set
+	for (i = 0; i < sp.nchunks; ++i) {
+		CHUNK *c = &sp.chunks[i];
+		c->no.udata = c;
+		c->no.command_cb = p->no->command_cb ? ecRecCommand : NULL;
+		c->no.font_cb = p->no->font_cb ? ecRecFont : NULL;
+		c->no.info_cb = p->no->info_cb ? ecRecInfo : NULL;
+		c->no.date_cb = p->no->date_cb ? ecRecDate : NULL;
+		c->no.style_cb = p->no->style_cb ? ecRecStyle : NULL;
+		c->no.color_cb = p->no->color_cb ? ecRecColor : NULL;
+		c->no.char_cb = p->no->char_cb ? ecRecChar : NULL;
+		c->no.text_cb = p->no->text_cb || p->no->run_cb ? ecRecText : NULL;
+		c->no.pict_cb = p->no->pict_cb ? ecRecPict : NULL;
+		c->no.pict_begin_cb = p->no->pict_begin_cb ? ecRecPictBegin : NULL;
+		c->no.pict_chunk_cb = p->no->pict_chunk_cb ? ecRecPictChunk : NULL;
+		c->no.pict_end_cb = p->no->pict_end_cb ? ecRecPictEnd : NULL;
+	}
+
+	pthread_mutex_init(&sp.lock, NULL);
+	pthread_cond_init(&sp.cond, NULL);
+	for (i = 0; i < nthreads && i < sp.nchunks; ++i)
+		if (pthread_create(&threads[nthr], NULL, ecParseChunks, &sp) == 0)
+			nthr++;
+
+	for (i = 0; i < sp.nchunks && ec == ecOK && !p->fStop; ++i) {
+		CHUNK *c = &sp.chunks[i];
+		if (nthr == 0)
+			ecParseChunk(&sp, c);
+		else {
+			pthread_mutex_lock(&sp.lock);
+			while (!c->fDone)
+				pthread_cond_wait(&sp.cond, &sp.lock);
+			pthread_mutex_unlock(&sp.lock);
+		}
+
+		if (!c->fLost && ecSameRtfState(p, sp.seed, c->p->cGroupMin, 
+					c->p->fTouched, c->p->fReset))
+		{
+			// guess is right
+			start = *p->prop;
+			ecReplay(p, c);
+			ec = c->ec;
+			ecKeepSaved(c->p, p, c->p->cGroupMin, &start);
+			if (ecCopyRtfState(p, c->p) != ecOK)
+				ec = ecStackOverflow;
+			ecSetProps(p->prop, &start, ~c->p->fTouched);
+		} else {
+			// parse again from real state
+			p->pIn = sp.buf + c->start;
+			p->pInEnd = sp.buf + c->end;
+			ec = ecRtfParseBlock(p);
+		}
+		free(c->log.str);
+		c->log.str = NULL;
+		rtf_parser_destroy(c->p);
+		c->p = NULL;
+	}
+
+	// stop threads and free chunks left
+	pthread_mutex_lock(&sp.lock);
+	sp.fStop = fTrue;
+	pthread_mutex_unlock(&sp.lock);
+	for (i = 0; i < nthr; ++i)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < sp.nchunks; ++i) {
+		free(sp.chunks[i].log.str);
+		rtf_parser_destroy(sp.chunks[i].p);
+	}
+	pthread_mutex_destroy(&sp.lock);
+	pthread_cond_destroy(&sp.cond);
+	free(threads);
+	free(sp.chunks);
+	rtf_parser_destroy(sp.seed);
+
+	if (ec != ecOK)
+		return ec;
+	return ecRtfEndInput(p);
+}
+
+#else
+
+int rtf_parser_parse_buffer_parallel(
+		rtf_parser_t *p,
+		const char *buf,
+		size_t len,
+		int nthreads
+		)
+{
+	return rtf_parser_parse_buffer(p, buf, len);
+}
+
+#endif
+
+//
+// %%Function: ecRtfParseBufferParallel
+//
+// Parse RTF document from memory buffer on nthreads
+// threads with temporary parser context.
+//
+int ecRtfParseBufferParallel(
+		const char *buf,
+		size_t len,
+		prop_t *prop,
+		rnotify_t *no,
+		int nthreads
+		)
+{
+	int ec;
+	rtf_parser_t *p = rtf_parser_create(prop, no);
+	if (!p)
+		return ecStackOverflow;
+	ec = rtf_parser_parse_buffer_parallel(p, buf, len, nthreads);
+	rtf_parser_destroy(p);
+	return ec;
+}
+
+//
+// PULL PARSING
+//
+// Reader sets its own callbacks which put events into a
+// queue and set fPause, so ecRtfParseBlock stops after the
+// token that gave events. rtf_next_event returns queued
+// events and parses further only when the queue is empty.
+// Data of events (text, font, picture chunk...) is copied,
+// because parser reuses its buffers; queue is cleared when
+// all events are taken.
+//
+
+// queued event - pointers of ev are set when it is taken
+typedef struct pullev {
+	rtf_event_t ev;
+	size_t off;                  // offset of struct in data
+	size_t offText;              // offset of text in data
+} PULLEV;
+
+struct rtf_reader {
+	rtf_parser_t *p;
+	prop_t prop;
+	rnotify_t no;
+	struct str evs;              // queued events
+	struct str data;             // data of queued events
+	size_t head;                 // next event to take
+	size_t n;                    // number of queued events
+	bool fLost;                  // out of memory while queueing
+	bool fEnd;                   // input is parsed
+	int ec;                      // result of parse
+};
+
+//
+// %%Function: ecPullData
+//
+// Append len bytes to data of queued events, aligned for
+// any struct, and terminate them with null char. Return
+// offset of data.
+//
+static size_t
+ecPullData(rtf_reader_t *r, const void *data, size_t len)
+{
+	static const char zero[16];
+	size_t off = r->data.len;
+	size_t pad = (16 - off % 16) % 16;
+	if (str_append(&r->data, zero, pad) ||
+			str_append(&r->data, (const char *)data, len) ||
+			str_append(&r->data, zero, 1))
+		r->fLost = fTrue;
+	return off + pad;
+}
+
+//
+// %%Function: ecPullEvent
+//
+// Queue event with copy of struct obj and text or data,
+// and pause parser. Return queued event to fill or NULL
+// if out of memory.
+//
+static rtf_event_t *
+ecPullEvent(rtf_reader_t *r, tEVENT type, 
+		const void *obj, size_t lobj, const void *text, size_t len)
+{
+	PULLEV e;
+	memset(&e, 0, sizeof(e));
+	e.ev.type = type;
+	if (lobj)
+		e.off = ecPullData(r, obj, lobj);
+	if (text)
+		e.offText = ecPullData(r, text, len);
+	r->p->fPause = fTrue;
+	if (r->fLost || str_append(&r->evs, (const char *)&e, sizeof(e))){
+		r->fLost = fTrue;
+		return NULL;
+	}
+	r->n++;
+	return &((PULLEV *)r->evs.str)[r->n - 1].ev;
+}
+
+//
+// %%Function: ecPullCommand
+//
+// Queue control words not known to parser.
+//
+static int
+ecPullCommand(void *udata, const char *s, int param, char fParam)
+{
+	rtf_event_t *ev;
+	if (ecLookupKeyword(s) >= 0)
+		return 0;
+	ev = ecPullEvent(udata, event_command, NULL, 0, s, strlen(s));
+	if (ev){
+		ev->len = strlen(s);
+		ev->param = param;
+		ev->fParam = fParam;
+	}
+	return 0;
+}
+
+static int
+ecPullFont(void *udata, FONT *f)
+{
+	ecPullEvent(udata, event_font, f, sizeof(FONT), NULL, 0);
+	return 0;
+}
+
+static int
+ecPullInfo(void *udata, tINFO t, const char *s)
+{
+	rtf_event_t *ev = ecPullEvent(udata, event_info, NULL, 0, s, strlen(s));
+	if (ev){
+		ev->info = t;
+		ev->len = strlen(s);
+	}
+	return 0;
+}
+
+static int
+ecPullDate(void *udata, tDATE t, DATE *d)
+{
+	rtf_event_t *ev = ecPullEvent(udata, event_date, d, sizeof(DATE), NULL, 0);
+	if (ev)
+		ev->tdate = t;
+	return 0;
+}
+
+static int
+ecPullStyle(void *udata, STYLE *s)
+{
+	ecPullEvent(udata, event_style, s, sizeof(STYLE), NULL, 0);
+	return 0;
+}
+
+static int
+ecPullColor(void *udata, COLOR *c)
+{
+	ecPullEvent(udata, event_color, c, sizeof(COLOR), NULL, 0);
+	return 0;
+}
+
+static int
+ecPullChar(void *udata, STREAM s, prop_t *p, int ch)
+{
+	rtf_reader_t *r = udata;
+	rtf_event_t *ev;
+	switch (ch) {
+		case PAR:
+			ev = ecPullEvent(r, event_par, NULL, 0, NULL, 0);
+			break;
+		case SECT:
+			ev = ecPullEvent(r, event_sect, NULL, 0, NULL, 0);
+			break;
+		case CELL:
+			ev = ecPullEvent(r, event_cell, &p->tcp, sizeof(TCP), NULL, 0);
+			break;
+		case ROW:
+			ev = ecPullEvent(r, event_row, &p->trp, sizeof(TRP), NULL, 0);
 			break;
-		
 		default:
-			rds = rdsSkip;     // when in doubt, skip it...
+			ev = ecPullEvent(r, event_char, NULL, 0, NULL, 0);
 			break;
 	}
-	return ecOK;
+	if (ev){
+		ev->s = s;
+		ev->ch = ch;
+		ev->chp = rtf_parser_chp_id(r->p);
+		ev->pap = rtf_parser_pap_id(r->p);
+	}
+	return 0;
+}
+
+static int
+ecPullRun(void *udata, STREAM s, int chp, int pap, 
+		const char *utf8, size_t len)
+{
+	rtf_event_t *ev = ecPullEvent(udata, event_text, NULL, 0, utf8, len);
+	if (ev){
+		ev->s = s;
+		ev->chp = chp;
+		ev->pap = pap;
+		ev->len = len;
+	}
+	return 0;
 }
 
 //
-// %%Function: ecEndGroupAction
+// %%Function: ecPullPict
 //
-// The destination specified by rds is coming to a close.
-// If there's any cleanup that needs to be done, do it now.
+// Queue picture event with copy of PICT - picture data
+// comes only with event_pict_data.
 //
-int
-ecEndGroupAction(RDS rds)
+static rtf_event_t *
+ecPullPict(rtf_reader_t *r, tEVENT type, PICT *pict, 
+		const unsigned char *data, size_t len)
 {
-	if (rds == rdsPict){
-		// parse picture
-		if (img.str){
-			// convert image hex string to binary
-			pict.len = img.len/2;
-			pict.data = 
-				(unsigned char*)malloc(pict.len);
-			if (!pict.data) // not enough memory
-				return ecStackOverflow;
-			char cur[3];
-			unsigned int val;
-			size_t i, l;
-			for (i = 0, l = 0; i < img.len;) {
-				cur[0] = img.str[i++];
-				cur[1] = img.str[i++];
-				cur[2] = 0;
-				sscanf(cur, "%x", &val);
-				pict.data[l++] = (unsigned char)val;
-			}
-			// do callback
-			if (no->pict_cb)
-				no->pict_cb(no->udata, prop, &pict);
-
-			free(img.str);
-			free(pict.data);
-		}
-		return ecOK;
+	PICT pc = *pict;
+	rtf_event_t *ev;
+	pc.data = NULL;
+	ev = ecPullEvent(r, type, &pc, sizeof(PICT), data, len);
+	if (ev){
+		ev->len = len;
+		ev->chp = rtf_parser_chp_id(r->p);
+		ev->pap = rtf_parser_pap_id(r->p);
 	}
-	if (rds == rdsInfoString){
-		info[linfo] = 0;
-		if (*info)
-			if (no->info_cb)
-				no->info_cb(no->udata, tinfo, info);
-		return ecOK;
+	return ev;
+}
+
+static int
+ecPullPictBegin(void *udata, prop_t *p, PICT *pict)
+{
+	(void)p;
+	ecPullPict(udata, event_pict_begin, pict, NULL, 0);
+	return 0;
+}
+
+static int
+ecPullPictChunk(void *udata, PICT *pict, 
+		const unsigned char *data, size_t len)
+{
+	ecPullPict(udata, event_pict_data, pict, data, len);
+	return 0;
+}
+
+static int
+ecPullPictEnd(void *udata, prop_t *p, PICT *pict, size_t len)
+{
+	(void)p;
+	ecPullPict(udata, event_pict_end, pict, NULL, len);
+	return 0;
+}
+
+//
+// %%Function: ecReaderCreate
+//
+// Allocate reader with parser which queues all events.
+//
+static rtf_reader_t *
+ecReaderCreate(void)
+{
+	rtf_reader_t *r = calloc(1, sizeof(rtf_reader_t));
+	if (!r)
+		return NULL;
+	r->no.udata = r;
+	r->no.command_cb = ecPullCommand;
+	r->no.font_cb = ecPullFont;
+	r->no.info_cb = ecPullInfo;
+	r->no.date_cb = ecPullDate;
+	r->no.style_cb = ecPullStyle;
+	r->no.color_cb = ecPullColor;
+	r->no.char_cb = ecPullChar;
+	r->no.run_cb = ecPullRun;
+	r->no.pict_begin_cb = ecPullPictBegin;
+	r->no.pict_chunk_cb = ecPullPictChunk;
+	r->no.pict_end_cb = ecPullPictEnd;
+	r->p = rtf_parser_create(&r->prop, &r->no);
+	if (!r->p || str_init(&r->evs, 16 * sizeof(PULLEV)) ||
+			str_init(&r->data, BUFSIZ))
+	{
+		rtf_reader_close(r);
+		return NULL;
 	}
-	if (rds == rdsInfoDate){
-		if (no->date_cb)
-			no->date_cb(no->udata, tdate, &date);
-		return ecOK;
+	ecResetRtfState(r->p);
+	return r;
+}
+
+//
+// %%Function: rtf_reader_open
+//
+// Open RTF file for pull parsing. File is read by large
+// blocks into parser input buffer.
+//
+rtf_reader_t *
+rtf_reader_open(FILE *fp)
+{
+	rtf_reader_t *r = ecReaderCreate();
+	if (!r)
+		return NULL;
+	r->p->bufIn = malloc(RTF_INBUFSIZ);
+	if (!r->p->bufIn){
+		rtf_reader_close(r);
+		return NULL;
 	}
+	r->p->fpIn = fp;
+	r->p->pIn = r->p->pInEnd = r->p->bufIn;
+	return r;
+}
 
-	return ecOK;
+//
+// %%Function: rtf_reader_open_buffer
+//
+// Open RTF document in memory buffer for pull parsing.
+//
+rtf_reader_t *
+rtf_reader_open_buffer(const char *buf, size_t len)
+{
+	rtf_reader_t *r = ecReaderCreate();
+	if (!r)
+		return NULL;
+	r->p->fpIn = NULL;
+	r->p->pIn = (const unsigned char *)buf;
+	r->p->pInEnd = r->p->pIn + len;
+	return r;
 }
 
 //
-// %%Function: ecParseSpecialKeyword
+// %%Function: rtf_next_event
 //
-// Evaluate an RTF control that needs special processing.
+// Take next queued event. If queue is empty, parse until
+// some tokens give events or input ends.
 //
 int
-ecParseSpecialKeyword(IPFN ipfn)
+rtf_next_event(rtf_reader_t *r, rtf_event_t *ev)
 {
-	if (rds == rdsSkip && ipfn != ipfnBin) // if we're skipping, and it's not
-		return ecOK;                         // the \bin keyword, ignore it.
-			 
-	switch (ipfn)
-	{
-		case ipfnBin:
-			ris = risBin;
-			cbBin = lParam;
+	rtf_parser_t *p = r->p;
+	const PULLEV *e;
+	const void *obj;
+
+	while (r->head == r->n){
+		r->evs.len = 0;
+		r->data.len = 0;
+		r->head = r->n = 0;
+		if (r->fEnd){
+			memset(ev, 0, sizeof(rtf_event_t));
+			ev->type = event_end;
+			return r->ec;
+		}
+		p->fPause = fFalse;
+		r->ec = ecRtfParseBlock(p);
+		if (r->ec == ecOK && !p->fPause){
+			r->ec = ecRtfEndInput(p);
+			r->fEnd = fTrue;
+		}
+		if (r->ec == ecOK && r->fLost)
+			r->ec = ecStackOverflow;
+		if (r->ec != ecOK)
+			r->fEnd = fTrue;
+	}
+
+	e = (const PULLEV *)r->evs.str + r->head++;
+	*ev = e->ev;
+	obj = r->data.str + e->off;
+	switch (ev->type) {
+		case event_text:
+		case event_info:
+		case event_command:
+			ev->text = r->data.str + e->offText;
 			break;
-		case ipfnSkipDest:
-			fSkipDestIfUnk = fTrue;
+		case event_cell:
+			ev->tcp = obj;
+			break;
+		case event_row:
+			ev->trp = obj;
+			break;
+		case event_font:
+			ev->font = obj;
+			break;
+		case event_color:
+			ev->color = obj;
+			break;
+		case event_style:
+			ev->style = obj;
+			break;
+		case event_date:
+			ev->date = obj;
+			break;
+		case event_pict_data:
+			ev->data = (const unsigned char *)r->data.str + e->offText;
+			ev->pict = obj;
+			break;
+		case event_pict_begin:
+		case event_pict_end:
+			ev->pict = obj;
 			break;
-		case ipfnHex:
-			ris = risHex;
-		break;
-			 
 		default:
-			return ecBadTable;
+			break;
 	}
 	return ecOK;
 }
 
 //
-// %%Function: ecRtfParse
+// %%Function: rtf_reader_parser
 //
-// Step 1:
-// Isolate RTF keywords and send them to ecParseRtfKeyword;
-// Push and pop state at the start and end of RTF groups;
-// Send text to ecParseChar for further processing.
-
-int ecRtfParse(
-		FILE *fp,
-		prop_t *_prop,
-		rnotify_t *_no
-		)
+// Return parser of reader.
+//
+rtf_parser_t *
+rtf_reader_parser(rtf_reader_t *r)
 {
-	fpIn = fp;
-	prop = _prop;
-	// set prop to 0
-	memset(prop, 0, sizeof(prop_t));
-
-	no = _no;
-			
-	int ch;
-	int ec;
-	int cNibble = 2;
-	int b = 0;
-	while ((ch = getc(fp)) != EOF)
-	{
-		if (cGroup < 0)
-			return ecStackUnderflow;
-		if (ris == risBin) // if we're parsing binary data, 
-											 // handle it directly
-		{
-			if ((ec = ecParseChar(ch)) != ecOK)
-				return ec;
-		}
-		else
-		{
-			switch (ch)
-			{
-				case '{':
-					if ((ec = ecPushRtfState()) != ecOK)
-						return ec;
-						break;
-				case '}':
-					if ((ec = ecPopRtfState()) != ecOK)
-						return ec;
-						break;
-				case '\\':
-					if ((ec = ecParseRtfKeyword(fp)) != ecOK)
-						return ec;
-						break;
-				case 0x0d:
-				case 0x0a:  // cr and lf are noise characters...
-						break;
-				default:
-					if (ris == risNorm)
-					{
-						if ((ec = ecParseChar(ch)) != ecOK)
-							return ec;
-					}
-					else {
-						if (ris != risHex)
-							return ecAssertion;
-						
-						if (isUTF){ // skip HEX if after UTF code
-							cNibble--;
-							if (!cNibble)
-							{
-								cNibble = 2;
-								b = 0;
-								ris = risNorm;
-							}
-							break;
-						}
+	return r->p;
+}
 
-						b = b << 4;
-						if (isdigit(ch))
-							b += (char) ch - '0';
-						else
-						{
-							if (islower(ch))
-							{
-								if (ch < 'a' || ch > 'f')
-									return ecInvalidHex;
-								b += (char) ch - 'a';
-							}
-							else
-							{
-								if (ch < 'A' || ch > 'F')
-									return ecInvalidHex;
-								b += (char) ch - 'A';
-							}
-						}
-						cNibble--;
-						if (!cNibble)
-						{
-							if ((ec = ecParseChar(b)) != ecOK)
-								return ec;
-							cNibble = 2;
-							b = 0;
-							ris = risNorm;
-						}
-					}         // end else (ris != risNorm)
-					break;
-				}           // switch
-			}         // else (ris != risBin)
-		}							// while
-		if (cGroup < 0)
-			return ecStackUnderflow;
-		if (cGroup > 0)
-			return ecUnmatchedBrace;
-	return ecOK;
+//
+// %%Function: rtf_reader_close
+//
+// Free pull parser context.
+//
+void
+rtf_reader_close(rtf_reader_t *r)
+{
+	if (!r)
+		return;
+	rtf_parser_destroy(r->p);
+	free(r->evs.str);
+	free(r->data.str);
+	free(r);
 }
 
 //
 // %%Function: ecPushRtfState
 //
-// Save relevant info on a linked list of SAVE structures.
+// Push new SAVE structure on the group stack. Property
+// blocks are saved later, when they are changed inside the
+// group (see ecSaveProp). The stack is kept between parses.
 //
 int
-ecPushRtfState(void)
+ecPushRtfState(rtf_parser_t *p)
 {
-	SAVE *psaveNew = malloc(sizeof(SAVE));
-	if (!psaveNew)
-		return ecStackOverflow;
-	psaveNew -> pNext = psave;
-	psaveNew -> chp = prop->chp;
-	psaveNew -> pap = prop->pap;
-	psaveNew -> sep = prop->sep;
-	psaveNew -> dop = prop->dop;
-	psaveNew -> trp = prop->trp;
-	psaveNew -> tcp = prop->tcp;
-	psaveNew -> rds = rds;
-	psaveNew -> ris = ris;
-	ris = risNorm;
-	psave = psaveNew;
-	cGroup++;
+	SAVE *psave;
+	if (p->lRun)
+		ecFlushRun(p);
+	if (p->cGroup == p->sstack){
+		int sstack = p->sstack ? p->sstack * 2 : 32;
+		void *ptr = realloc(p->stack, sstack * sizeof(SAVE));
+		if (!ptr)
+			return ecStackOverflow;
+		p->stack = ptr;
+		p->sstack = sstack;
+	}
+	psave = &p->stack[p->cGroup++];
+	psave -> fSaved = 0;
+	psave -> rds = p->rds;
+	psave -> ris = p->ris;
+	psave -> uc = p->uc;
+	p->ris = risNorm;
+	// braces end fallback chars of \u
+	p->cUcSkip = 0;
 	return ecOK;
 }
 
@@ -1242,45 +4357,75 @@ ecPushRtfState(void)
 //
 // If we're ending a destination (that is, the destination is changing),
 // call ecEndGroupAction.
-// Always restore relevant info from the top of the SAVE list.
+// Always restore relevant info from the top of the group stack.
 //
 int
-ecPopRtfState(void)
+ecPopRtfState(rtf_parser_t *p)
 {
-	SAVE *psaveOld;
+	SAVE *psave;
 	int ec;
-	if (!psave)
+	if (!p->cGroup)
 		return ecStackUnderflow;
-	if (rds != psave->rds)
+	if (p->lRun)
+		ecFlushRun(p);
+	psave = &p->stack[p->cGroup - 1];
+	if (p->rds != psave->rds)
 	{
-		if ((ec = ecEndGroupAction(rds)) != ecOK)
+		if ((ec = ecEndGroupAction(p, p->rds)) != ecOK)
 			return ec;
 	}
-	prop->chp = psave->chp;
-	prop->pap = psave->pap;
-	prop->sep = psave->sep;
-	prop->dop = psave->dop;
-	prop->trp = psave->trp;
-	prop->tcp = psave->tcp;
-	rds = psave->rds;
-	ris = psave->ris;
-	psaveOld = psave;
-	psave = psave->pNext;
-	cGroup--;
-	free(psaveOld);
+	if (psave->fSaved){
+		p->fTouched |= psave->fSaved;
+		if (psave->fSaved & (1 << propChp))
+			p->prop->chp = psave->chp;
+		if (psave->fSaved & (1 << propPap))
+			p->prop->pap = psave->pap;
+		if (psave->fSaved & (1 << propSep))
+			p->prop->sep = psave->sep;
+		if (psave->fSaved & (1 << propDop))
+			p->prop->dop = psave->dop;
+		if (psave->fSaved & (1 << propTrp))
+			p->prop->trp = psave->trp;
+		if (psave->fSaved & (1 << propTcp))
+			p->prop->tcp = psave->tcp;
+	}
+	p->rds = psave->rds;
+	p->ris = psave->ris;
+	p->uc = psave->uc;
+	p->cUcSkip = 0;
+	p->cGroup--;
+	if (p->cGroup < p->cGroupMin)
+		p->cGroupMin = p->cGroup;
 
 	return ecOK;
 }
 
+//
+// %%Function: ecCutKeyword
+//
+// Input ends inside control word. If input is pushed by
+// rtf_feed, put input position back to start of control
+// word to parse it again with next input.
+//
+static int
+ecCutKeyword(rtf_parser_t *p, const unsigned char *start)
+{
+	if (!p->fPush)
+		return ecEndOfFile;
+	p->pIn = start;
+	return ecMoreInput;
+}
+
 //
 // %%Function: ecParseRtfKeyword
 //
 // Step 2:
 // get a control word (and its associated value) and
 // call ecTranslateKeyword to dispatch the control.
+// Too long control words and parameters are cut.
 //
 int
-ecParseRtfKeyword(FILE *fp)
+ecParseRtfKeyword(rtf_parser_t *p)
 {
 	int ch;
 	char fParam = fFalse;
@@ -1289,29 +4434,36 @@ ecParseRtfKeyword(FILE *fp)
 	char *pch;
 	char szKeyword[30];
 	char szParameter[20];
+	const unsigned char *start = p->pIn - 1;
 	szKeyword[0] = '\0';
 	szParameter[0] = '\0';
 	
-	if ((ch = getc(fp)) == EOF)
-		return ecEndOfFile;
+	if ((ch = ecGetc(p)) == EOF)
+		return ecCutKeyword(p, start);
 		 
 	// a control symbol; no delimiter.
 	if (!isalpha(ch)) 
 	{
 		szKeyword[0] = (char) ch;
 		szKeyword[1] = '\0';
-		return ecTranslateKeyword(szKeyword, 0, fParam);
+		if (p->cUcSkip > 0 && ch != '\''){
+			// fallback char of \u
+			p->cUcSkip--;
+			return ecOK;
+		}
+		return ecTranslateKeyword(p, szKeyword, 0, fParam);
 	}
 		 
-	for (pch = szKeyword; isalpha(ch); ch = getc(fp))
-		*pch++ = (char) ch;
+	for (pch = szKeyword; isalpha(ch); ch = ecGetc(p))
+		if (pch < szKeyword + sizeof(szKeyword) - 1)
+			*pch++ = (char) ch;
 		 
 	*pch = '\0';
 	if (ch == '-')
 	{
 		fNeg    = fTrue;
-		if ((ch = getc(fp)) == EOF)
-			return ecEndOfFile;
+		if ((ch = ecGetc(p)) == EOF)
+			return ecCutKeyword(p, start);
 	}
 
 	if (isdigit(ch))
@@ -1319,8 +4471,9 @@ ecParseRtfKeyword(FILE *fp)
 		// a digit after the control means we have a parameter
 		fParam = fTrue;
 		
-		for (pch = szParameter; isdigit(ch); ch = getc(fp))
-			*pch++ = (char) ch;
+		for (pch = szParameter; isdigit(ch); ch = ecGetc(p))
+			if (pch < szParameter + 10)
+				*pch++ = (char) ch;
 				 
 		*pch = '\0';
 		param = atoi(szParameter);
@@ -1328,92 +4481,245 @@ ecParseRtfKeyword(FILE *fp)
 		if (fNeg)
 			param = -param;
 				 
-		lParam = atol(szParameter);
+		p->lParam = atol(szParameter);
 		
 		if (fNeg)
-			param = -param;
+			p->lParam = -p->lParam;
 	}
 
-	if (no->command_cb)
-		no->command_cb(no->udata, szKeyword, param, fParam);
+	if (ch == EOF && p->fPush)
+		return ecCutKeyword(p, start);
+
+	if (p->no->command_cb)
+		p->no->command_cb(p->no->udata, szKeyword, param, fParam);
 	
 	if (ch != ' ')
-		ungetc(ch, fp);
+		ecUngetc(p, ch);
+
+	if (p->cUcSkip > 0){
+		// control word is one fallback char of \u - \bin
+		// with its data too
+		p->cUcSkip--;
+		if (strcmp(szKeyword, "bin") != 0 || p->rds == rdsPict)
+			return ecOK;
+		if (fParam && p->lParam > 0)
+			p->cUcSkip += p->lParam;
+	}
 		 
-	return ecTranslateKeyword(szKeyword, param, fParam);
+	return ecTranslateKeyword(p, szKeyword, param, fParam);
 }
 
 int
-ecAddFont(int ch, char alt)
+ecAddFont(rtf_parser_t *p, int ch, char alt)
 {
 	if (ch == ';'){
-		fnt.name[fnt.lname] = 0;
-		fnt.falt[fnt.lfalt] = 0;
+		p->fnt.name[p->fnt.lname] = 0;
+		p->fnt.falt[p->fnt.lfalt] = 0;
 
-		if (no->font_cb)
-			no->font_cb(no->udata, &fnt);
-		memset(&fnt, 0, sizeof(FONT));
+		if (p->no->font_cb)
+			p->no->font_cb(p->no->udata, &p->fnt);
+		memset(&p->fnt, 0, sizeof(FONT));
 		return ecOK;
 	}
 
-	if (alt)
-		fnt.falt[fnt.lfalt++] = ch;
-	else 
-		fnt.name[fnt.lname++] = ch;
+	// keep room for null char, drop the rest of long names
+	if (alt){
+		if (p->fnt.lfalt < (int)(sizeof(p->fnt.falt) / sizeof(int)) - 1)
+			p->fnt.falt[p->fnt.lfalt++] = ch;
+	} else if (p->fnt.lname < (int)sizeof(p->fnt.name) - 1)
+		p->fnt.name[p->fnt.lname++] = ch;
 	
 	return ecOK;
 }
 
 int
-ecAddColor(int ch)
+ecAddColor(rtf_parser_t *p, int ch)
 {
 	if (ch == ';'){
-		if (no->color_cb)
-			no->color_cb(no->udata, &col);
-		memset(&col, 0, sizeof(COLOR));
+		if (p->no->color_cb)
+			p->no->color_cb(p->no->udata, &p->col);
+		memset(&p->col, 0, sizeof(COLOR));
 	}
 	return ecOK;
 }
 
 int
-ecAddInfoString(int ch)
+ecAddInfoString(rtf_parser_t *p, int ch)
+{
+	if (p->linfo < sizeof(p->info))
+		p->info[p->linfo++] = ch;
+	return ecOK;
+}
+
+//
+// %%Function: ecFlushPicture
+//
+// Send decoded picture data to pict_chunk_cb by chunks of
+// RTF_PICTCHUNK bytes (and the rest at the end of picture).
+// Sent data is dropped if pict_cb does not need it.
+//
+void
+ecFlushPicture(rtf_parser_t *p, bool fEnd)
+{
+	size_t off = p->pictSent - p->pictDrop, len;
+	// whole picture is kept for pict_cb, else data is
+	// dropped as it is sent (even if only pict_end_cb wants
+	// the size)
+	if (p->no->pict_cb && !p->no->pict_begin_cb && !p->no->pict_chunk_cb)
+		return;
+	if (!p->fPictBegun && (fEnd || p->img.len - off >= RTF_PICTCHUNK)){
+		p->fPictBegun = fTrue;
+		if (p->no->pict_begin_cb)
+			p->no->pict_begin_cb(p->no->udata, p->prop, &p->pict);
+	}
+	while (off < p->img.len){
+		len = p->img.len - off;
+		if (len > RTF_PICTCHUNK)
+			len = RTF_PICTCHUNK;
+		else if (len < RTF_PICTCHUNK && !fEnd)
+			break;
+		if (p->no->pict_chunk_cb)
+			p->no->pict_chunk_cb(p->no->udata, &p->pict, 
+					(unsigned char *)p->img.str + off, len);
+		off += len;
+		p->pictSent += len;
+	}
+	if (!p->no->pict_cb && off){
+		// keep only data not sent yet
+		memmove(p->img.str, p->img.str + off, p->img.len - off);
+		p->img.len -= off;
+		p->pictDrop += off;
+	}
+}
+
+//
+// %%Function: ecDecodePictureHex
+//
+// Decode run of picture hex data right into picture buffer.
+// Non hex chars are ignored.
+//
+static int
+ecDecodePictureHex(rtf_parser_t *p, const unsigned char *s, size_t len)
 {
-	if (linfo < sizeof(info))
-		info[linfo++] = ch;
+	const unsigned char *end = s + len;
+	unsigned char *out;
+	int hi, lo;
+
+	// at most len/2 + 1 bytes to add
+	if (str_reserve(&p->img, p->img.len + len / 2 + 2))
+		return ecStackOverflow;
+	out = (unsigned char *)p->img.str + p->img.len;
+
+	// finish byte started in previous run
+	if (p->pictNibble >= 0){
+		while (s < end && rghexRtf[*s] < 0)
+			s++;
+		if (s == end)
+			return ecOK;
+		*out++ = p->pictNibble << 4 | rghexRtf[*s++];
+		p->pictNibble = -1;
+	}
+
+	while (s < end) {
+		// fast path - pair of hex digits
+		if (s + 1 < end){
+			hi = rghexRtf[s[0]];
+			lo = rghexRtf[s[1]];
+			if ((hi | lo) >= 0){
+				*out++ = hi << 4 | lo;
+				s += 2;
+				continue;
+			}
+		}
+		// skip non hex chars
+		hi = rghexRtf[*s++];
+		if (hi < 0)
+			continue;
+		while (s < end && rghexRtf[*s] < 0)
+			s++;
+		if (s == end){
+			p->pictNibble = hi;
+			break;
+		}
+		*out++ = hi << 4 | rghexRtf[*s++];
+	}
+
+	p->img.len = (char *)out - p->img.str;
+	p->img.str[p->img.len] = 0;
 	return ecOK;
 }
 
+//
+// %%Function: ecAddPictureRun
+//
+// Decode run of picture hex data. Long runs are decoded
+// piece by piece, so picture buffer has constant size when
+// the picture is streamed to pict_chunk_cb.
+//
 int
-ecAddPicture(int ch)
-{
-	// add only if hex
-	if (ch == 'a' || ch == 'A' ||
-			ch == 'b' || ch == 'B' ||
-			ch == 'c' || ch == 'C' ||
-			ch == 'd' || ch == 'D' ||
-			ch == 'e' || ch == 'E' ||
-			ch == 'f' || ch == 'F' ||
-			isdigit(ch))
-	{
-		char c = ch;
-		str_append(&img, &c, 1);
+ecAddPictureRun(rtf_parser_t *p, const unsigned char *s, size_t len)
+{
+	int ec;
+	size_t l;
+	while (len) {
+		l = len < RTF_PICTCHUNK * 2 ? len : RTF_PICTCHUNK * 2;
+		if ((ec = ecDecodePictureHex(p, s, l)) != ecOK)
+			return ec;
+		ecFlushPicture(p, fFalse);
+		s += l;
+		len -= l;
+	}
+	return ecOK;
+}
+
+//
+// %%Function: ecAddPictureBin
+//
+// Add run of picture binary data (after \bin).
+//
+int
+ecAddPictureBin(rtf_parser_t *p, const unsigned char *s, size_t len)
+{
+	size_t l;
+	while (len) {
+		l = len < RTF_PICTCHUNK ? len : RTF_PICTCHUNK;
+		if (str_append(&p->img, (const char *)s, l))
+			return ecStackOverflow;
+		ecFlushPicture(p, fFalse);
+		s += l;
+		len -= l;
 	}
 	return ecOK;
 }
 
 int
-ecAddStyle(int ch)
+ecAddPicture(rtf_parser_t *p, int ch)
+{
+	unsigned char c = ch;
+	return ecAddPictureRun(p, &c, 1);
+}
+
+int
+ecAddStyle(rtf_parser_t *p, int ch)
 {
+	STYLEDEF *psd = &p->stylesheet[p->nstyles];
 	if (ch == ';'){
-		stylesheet[nstyles].chp = prop->chp;
-		stylesheet[nstyles].pap = prop->pap;
-		stylesheet[nstyles].sep = prop->sep;
-		if (no->style_cb)
-			no->style_cb(no->udata, &(stylesheet[nstyles]));
-		nstyles++;
+		// style is sent to style_cb at the end of stylesheet
+		// when \sbasedon is resolved
+		p->fTouched |= 1 << propChp | 1 << propPap | 1 << propSep;
+		psd->st.chp = p->prop->chp;
+		psd->st.pap = p->prop->pap;
+		psd->st.sep = p->prop->sep;
+		if (psd->st.next < 0)
+			psd->st.next = psd->fDs ? psd->st.ds : psd->st.s;
+		if (ecMapStyle(psd->fDs ? &p->mapDStyle : &p->mapStyle,
+					psd->fDs ? psd->st.ds : psd->st.s, p->nstyles) != ecOK)
+			return ecStackOverflow;
+		p->nstyles++;
+		return ecNewStyle(p);
 	} else 
-		if (stylesheet[nstyles].lname < sizeof(stylesheet[nstyles].name))
-			stylesheet[nstyles].name[stylesheet[nstyles].lname++] = ch;
+		if (psd->st.lname < sizeof(psd->st.name))
+			psd->st.name[psd->st.lname++] = ch;
 	return ecOK;
 }
 
@@ -1422,37 +4728,42 @@ ecAddStyle(int ch)
 // Route the character to the appropriate destination stream.
 //
 int
-ecParseChar(int ch)
+ecParseChar(rtf_parser_t *p, int ch)
 {
-	if (ris == risBin && --cbBin <= 0)
-		ris = risNorm;
-	switch (rds)
+	if (p->ris == risBin && --p->cbBin <= 0)
+		p->ris = risNorm;
+	if (p->cUcSkip > 0){
+		// fallback char of \u
+		p->cUcSkip--;
+		return ecOK;
+	}
+	switch (p->rds)
 	{
 		case rdsSkip:
 			// Toss this character.
 			return ecOK;
 		
 		case rdsFonttbl:
-			return ecAddFont(ch, 0);
+			return ecAddFont(p, ch, 0);
 		
 		case rdsFalt:
-			return ecAddFont(ch, 1);
+			return ecAddFont(p, ch, 1);
 		
 		case rdsColor:
-			return ecAddColor(ch);
+			return ecAddColor(p, ch);
 
 		case rdsStyle:
-			return ecAddStyle(ch);
+			return ecAddStyle(p, ch);
 		
 		case rdsInfoString:
-			return ecAddInfoString(ch);
+			return ecAddInfoString(p, ch);
 		
 		case rdsPict:
-			return ecAddPicture(ch);
+			return ecAddPicture(p, ch);
 		
 		case rdsNorm:
 			// Output a character. Properties are valid at this point.
-			return ecPrintChar(ch);
+			return ecPrintChar(p, ch);
 			
 		default:
 			// handle other destinations....
@@ -1460,22 +4771,119 @@ ecParseChar(int ch)
 	}
 }
 
+//
+// %%Function: ecParseRun
+//
+// Route run of plain chars taken right from the input
+// buffer to the appropriate destination stream.
+//
+int
+ecParseRun(rtf_parser_t *p, const unsigned char *s, size_t len)
+{
+	int ec;
+	size_t i;
+	if (p->cUcSkip > 0 && p->rds != rdsPict){
+		// fallback chars of \u
+		i = len < (size_t)p->cUcSkip ? len : (size_t)p->cUcSkip;
+		p->cUcSkip -= i;
+		s += i;
+		len -= i;
+		if (!len)
+			return ecOK;
+	}
+	switch (p->rds)
+	{
+		case rdsSkip:
+			// Toss these characters.
+			return ecOK;
+
+		case rdsPict:
+			return ecAddPictureRun(p, s, len);
+
+		case rdsNorm:
+			if (p->no->text_cb || p->no->run_cb){
+				// ASCII goes as slices of input, 8-bit chars
+				// of code page as UTF-8
+				while (len) {
+					i = ecScanAscii(s, s + len) - s;
+					if (i)
+						ecAddRun(p, sMain, (const char *)s, i, fTrue);
+					if (i < len)
+						ecParseByte(p, s[i++]);
+					s += i;
+					len -= i;
+				}
+				return ecOK;
+			}
+			// fall through
+
+		default:
+			for (i = 0; i < len; ++i)
+				if ((ec = ecParseByte(p, s[i])) != ecOK)
+					return ec;
+			return ecOK;
+	}
+}
+
+//
+// %%Function: ecParseByte
+//
+// Route char of \'xx or 8-bit char of input: chars of
+// code page (\ansicpg) go as UTF-8, picture data and
+// fallback chars of \u as they are.
+//
+int
+ecParseByte(rtf_parser_t *p, int ch)
+{
+	int i, len, ec;
+	char s[6];
+
+	if (ch < 0x80 || p->rds == rdsPict || p->cUcSkip > 0)
+		return ecParseChar(p, ch);
+	len = c32tomb(s, p->cpg->rgch[ch - 0x80]);
+	for (i = 0; i < len; ++i)
+		if ((ec = ecParseChar(p, (unsigned char)s[i])) != ecOK)
+			return ec;
+	return ecOK;
+}
+
 //
 // %%Function: ecParseUTF
 //
 // Route the unicode character to the appropriate destination stream.
 //
 int
-ecParseUTF(int ch)
+ecParseUTF(rtf_parser_t *p, int ch)
 {
-	isUTF = fTrue; 
-	// Output a character. Properties are valid at this point.
-	int i;
+	int i, len, ec;
 	char s[6];
-	int len = c32tomb(s, ch);
-	for (i = 0; i < len; ++i) {
-		ecParseChar(s[i]);
-	}	
+
+	// characters above U+FFFF come as pair of surrogates
+	if (ch >= 0xD800 && ch < 0xDC00){
+		p->ucHigh = ch;
+		p->cUcSkip = p->uc;
+		return ecOK;
+	}
+	if (ch >= 0xDC00 && ch < 0xE000){
+		ch = p->ucHigh ? 
+			0x10000 + ((p->ucHigh - 0xD800) << 10) + (ch - 0xDC00) : 
+			0xFFFD;
+	} else if (p->ucHigh){
+		// high surrogate without low one
+		len = c32tomb(s, 0xFFFD);
+		for (i = 0; i < len; ++i)
+			if ((ec = ecParseChar(p, (unsigned char)s[i])) != ecOK)
+				return ec;
+	}
+	p->ucHigh = 0;
+
+	// Output a character. Properties are valid at this point.
+	len = c32tomb(s, ch);
+	for (i = 0; i < len; ++i)
+		if ((ec = ecParseChar(p, (unsigned char)s[i])) != ecOK)
+			return ec;
+	// skip fallback chars of the character
+	p->cUcSkip = p->uc;
 	return ecOK;
 }
 
@@ -1485,13 +4893,23 @@ ecParseUTF(int ch)
 // Send a character to the output file.
 //
 int
-ecPrintChar(int ch)
+ecPrintChar(rtf_parser_t *p, int ch)
 {
 	STREAM s = sMain;
-	if (rds == rdsFootnote)
+	if (p->rds == rdsFootnote)
 		s = sFootnotes;
 	
-	if (no->char_cb)
-		no->char_cb(no->udata, s, prop, ch);
+	if (p->no->text_cb || p->no->run_cb){
+		// command chars end text run and go to char_cb
+		if (ch > 255){
+			ecFlushRun(p);
+		} else {
+			char c = ch;
+			ecAddRun(p, s, &c, 1, fFalse);
+			return ecOK;
+		}
+	}
+	if (p->no->char_cb)
+		p->no->char_cb(p->no->udata, s, p->prop, ch);
 	return ecOK;
 }
@@ -6,6 +6,8 @@
  Title Modified By  : Igor V. Sementsov <ig.kuzm@gmail.com>
  */
 
+#ifndef RTFREADR_H
+#define RTFREADR_H
 #include <stdio.h>
 #include "mswordtype.h"
 
@@ -60,21 +62,228 @@ typedef enum {
 	date_backup,
 } tDATE;
 
+/* callbacks may be NULL - destinations no callback wants
+ * (\fonttbl without font_cb, \pict without picture
+ * callbacks...) are skipped; if only info_cb and date_cb
+ * are set, parsing stops after \info */
 typedef struct rtfnotify {
 	void *udata;
+	/* every control word, skipped destinations too - when
+	 * it is set, skipped groups are parsed, not scanned */
 	int (*command_cb)(void *udata, const char *s, int param, char fParam);
 	int (*font_cb)(void *udata, FONT *p);
 	int (*info_cb)(void *udata, tINFO t, const char *s);
 	int (*date_cb)(void *udata, tDATE t, DATE *d);
+	/* styles of stylesheet with props of \sbasedon style
+	 * - called when stylesheet ends */
 	int (*style_cb)(void *udata, STYLE *s);
 	int (*color_cb)(void *udata, COLOR *c);
 	int (*char_cb)(void *udata, STREAM s, prop_t *p, int ch);
+	/* runs of text with unchanged formatting; if set,
+	 * char_cb gets only command chars (PAR, CELL, ROW...).
+	 * Text is UTF-8: \'xx and 8-bit chars are decoded with
+	 * code page of \ansicpg (1252 if it is not given) */
+	int (*text_cb)(void *udata, STREAM s, const prop_t *p,
+			const char *utf8, size_t len);
 	int (*pict_cb)(void *udata, prop_t *p, PICT *pict);
+	/* picture data by chunks as it is decoded - memory 
+	 * used does not depend on picture size (if pict_cb 
+	 * is not set); len of pict_end_cb is the size of
+	 * whole picture */
+	int (*pict_begin_cb)(void *udata, prop_t *p, PICT *pict);
+	int (*pict_chunk_cb)(void *udata, PICT *pict,
+			const unsigned char *data, size_t len);
+	int (*pict_end_cb)(void *udata, prop_t *p, PICT *pict, size_t len);
+	/* runs of text with ids of character and paragraph
+	 * properties instead of prop_t - equal properties 
+	 * have equal ids (see rtf_parser_chp); if set, it is 
+	 * called instead of text_cb */
+	int (*run_cb)(void *udata, STREAM s, int chp, int pap,
+			const char *utf8, size_t len);
 } rnotify_t;
 
+/* parser context - holds all parser state, so
+ * several documents may be parsed at the same time
+ * (each thread with its own context) */
+typedef struct rtf_parser rtf_parser_t;
+
+/* allocate parser context - return NULL on error */
+rtf_parser_t *rtf_parser_create(prop_t *prop, rnotify_t *no);
+
+/* parse RTF file with parser context and run callbacks */
+int rtf_parser_parse(rtf_parser_t *p, FILE *fp);
+
+/* parse RTF file by path with parser context and run
+ * callbacks - the file is mapped into memory and parsed
+ * in place */
+int rtf_parser_parse_file(rtf_parser_t *p, const char *path);
+
+/* parse RTF document from memory buffer with parser
+ * context and run callbacks */
+int rtf_parser_parse_buffer(rtf_parser_t *p,
+		const char *buf, size_t len);
+
+/* push parsing - parse next part of document as it comes
+ * (from network, message queue...) and run callbacks; the
+ * first rtf_feed starts new document. Parts may be cut
+ * anywhere, inside control words too, and buf is not used
+ * after return. After error rtf_feed returns it again 
+ * until rtf_finish */
+int rtf_feed(rtf_parser_t *p, const char *buf, size_t len);
+
+/* end document given by rtf_feed and check that all
+ * groups are closed - return error code */
+int rtf_finish(rtf_parser_t *p);
+
+/* parse RTF document from memory buffer on nthreads
+ * threads (number of cores if nthreads <= 0) - document
+ * is split into chunks at top level paragraphs; callbacks
+ * are called from the calling thread in the same order
+ * as rtf_parser_parse_buffer calls them; small documents
+ * are parsed by one thread */
+int rtf_parser_parse_buffer_parallel(rtf_parser_t *p,
+		const char *buf, size_t len, int nthreads);
+
+/* parse RTF file by path on nthreads threads (see
+ * rtf_parser_parse_buffer_parallel) */
+int rtf_parser_parse_file_parallel(rtf_parser_t *p,
+		const char *path, int nthreads);
+
+/* free parser context */
+void rtf_parser_destroy(rtf_parser_t *p);
+
+/* parser keeps table of unique character and paragraph
+ * properties of document - ids are small numbers from 0
+ * and are valid until next parse; functions may be
+ * called from callbacks */
+
+/* return id of current character properties or -1 if
+ * out of memory */
+int rtf_parser_chp_id(rtf_parser_t *p);
+
+/* return id of current paragraph properties or -1 if
+ * out of memory */
+int rtf_parser_pap_id(rtf_parser_t *p);
+
+/* return character properties with id or NULL */
+const CHP *rtf_parser_chp(rtf_parser_t *p, int id);
+
+/* return paragraph properties with id or NULL */
+const PAP *rtf_parser_pap(rtf_parser_t *p, int id);
+
+/* return number of unique character properties */
+int rtf_parser_nchps(rtf_parser_t *p);
+
+/* return number of unique paragraph properties */
+int rtf_parser_npaps(rtf_parser_t *p);
+
+/* pull parsing - events of document are returned one by
+ * one by rtf_next_event instead of callbacks
+ * USAGE:
+ * int ec;
+ * rtf_event_t ev;
+ * rtf_reader_t *r = rtf_reader_open_buffer(buf, len);
+ * while ((ec = rtf_next_event(r, &ev)) == ecOK &&
+ *         ev.type != event_end)
+ * {
+ *   if (ev.type == event_text)
+ *     fwrite(ev.text, 1, ev.len, stdout);
+ * }
+ * rtf_reader_close(r); */
+
+typedef enum {
+	event_end,        // end of document
+	event_text,       // run of UTF-8 text (text, len)
+	event_par,        // end of paragraph
+	event_sect,       // end of section
+	event_cell,       // end of cell (tcp)
+	event_row,        // end of row (trp)
+	event_char,       // other command char (ch)
+	event_font,       // font of font table (font)
+	event_color,      // color of color table (color)
+	event_style,      // style of stylesheet (style)
+	event_info,       // info string (info, text, len)
+	event_date,       // info date (tdate, date)
+	event_pict_begin, // start of picture (pict)
+	event_pict_data,  // chunk of picture data (pict, data, len)
+	event_pict_end,   // end of picture (pict, len is size)
+	event_command,    // unknown control word (text, param)
+} tEVENT;
+
+/* event of document - pointers are valid until next call
+ * of rtf_next_event */
+typedef struct rtf_event {
+	tEVENT type;
+	STREAM s;                   // stream of text and command chars
+	int ch;                     // command char (PAR, CELL, ROW...)
+	int chp;                    // id of character properties
+	int pap;                    // id of paragraph properties
+	const char *text;           // null-terminated text, info or keyword
+	const unsigned char *data;  // picture data
+	size_t len;                 // length of text or data
+	int param;                  // parameter of control word
+	char fParam;                // control word has parameter
+	tINFO info;
+	tDATE tdate;
+	const DATE *date;
+	const FONT *font;
+	const COLOR *color;
+	const STYLE *style;
+	const PICT *pict;
+	const TCP *tcp;
+	const TRP *trp;
+} rtf_event_t;
+
+/* pull parser context - keeps parser state between calls */
+typedef struct rtf_reader rtf_reader_t;
+
+/* open RTF file for pull parsing - file is read by
+ * blocks; return NULL on error */
+rtf_reader_t *rtf_reader_open(FILE *fp);
+
+/* open RTF document in memory buffer for pull parsing
+ * - buffer is not copied; return NULL on error */
+rtf_reader_t *rtf_reader_open_buffer(const char *buf, size_t len);
+
+/* parse document up to the next event and return it in
+ * ev - every call does only the work needed for next
+ * event; ev->type is event_end at the end of document or
+ * on error; return error code */
+int rtf_next_event(rtf_reader_t *r, rtf_event_t *ev);
+
+/* return parser of reader to get properties by ids of
+ * events (see rtf_parser_chp) */
+rtf_parser_t *rtf_reader_parser(rtf_reader_t *r);
+
+/* free pull parser context */
+void rtf_reader_close(rtf_reader_t *r);
+
 /* parse RTF file and run callbacks */
 int ecRtfParse(FILE *fp, prop_t *prop, rnotify_t *no);
 
+/* parse RTF file by path and run callbacks */
+int ecRtfParseFile(const char *path, prop_t *prop, rnotify_t *no);
+
+/* parse RTF document from memory buffer and run callbacks */
+int ecRtfParseBuffer(const char *buf, size_t len,
+		prop_t *prop, rnotify_t *no);
+
+/* extract plain UTF-8 text of RTF document from memory
+ * buffer - fast path which keeps no properties and skips
+ * destinations (font table, stylesheet, info, pictures, 
+ * headers, footnotes...) by matching braces; \'xx are
+ * decoded with code page of \ansicpg (1252 if it is not
+ * given); paragraphs and rows end with '\n', cells with
+ * '\t'. *text is allocated null-terminated string
+ * (free it with free), *ltext is its length */
+int ecRtfText(const char *buf, size_t len, 
+		char **text, size_t *ltext);
+
+/* parse RTF document from memory buffer on nthreads
+ * threads and run callbacks */
+int ecRtfParseBufferParallel(const char *buf, size_t len,
+		prop_t *prop, rnotify_t *no, int nthreads);
+
 // RTF parser error codes
 #define ecOK									0     // Everything's fine!
 #define ecStackUnderflow      1     // Unmatched '}'
@@ -84,3 +293,6 @@ int ecRtfParse(FILE *fp, prop_t *prop, rnotify_t *no);
 #define ecBadTable            5     // RTF table (sym or prop) invalid
 #define ecAssertion           6     // Assertion failure
 #define ecEndOfFile           7     // End of file reached while reading RTF
+#define ecOpenFile            8     // Can't open or map RTF file
+
+#endif /* ifndef RTFREADR_H */
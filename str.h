@@ -27,40 +27,53 @@
  * Simple dynamic string
  * USAGE:
  * struct str s;
- * str_init(&s);
- * str_append(&s, "Hello");
+ * str_init(&s, BUFSIZ);
+ * str_append(&s, "Hello", 5);
  * str_appendf(&s, " %s!", "world");
  * printf("%s\n", s.str);
- * free(s.str;
+ * free(s.str);
  */
 
 #ifndef STR_H_
 #define STR_H_
 #include <stdio.h>
+#include <stdarg.h>
 
 /* dynamic string structure */
 struct str {
-	char *str;   //null-terminated c string
-	int   len;   //length of string (without last null char)
-	int   size;  //allocated size
+	char  *str;   //null-terminated c string
+	size_t len;   //length of string (without last null char)
+	size_t size;  //allocated size
 };
 
 /* init string - return non-null on error */
-static int str_init(struct str *s, size_t size);
+static inline int str_init(struct str *s, size_t size);
 
-/* append c string */
-static void str_append(
-		struct str *s, const char *str, int len);
+/* make allocated size at least size bytes (with last
+ * null char) - memory grows twice, so appending is
+ * amortized O(1) - return non-null on error */
+static inline int str_reserve(struct str *s, size_t size);
 
-/* append fprint-like formated c string */
+/* free unused allocated memory - return non-null on error */
+static inline int str_shrink(struct str *s);
+
+/* append c string - return non-null on error */
+static inline int str_append(
+		struct str *s, const char *str, size_t len);
+
+/* append fprint-like formated c string - return 
+ * non-null on error */
 #define str_appendf(s, ...)
 
 /* IMPLIMATION */
 #include <string.h>
 #include <stdlib.h>
 
-int str_init(struct str *s, size_t size)
+static inline int str_init(struct str *s, size_t size)
 {
+	if (size < 1)
+		size = 1;
+
 	// allocate data
 	s->str = (char*)malloc(size);
 	if (!s->str)
@@ -74,47 +87,84 @@ int str_init(struct str *s, size_t size)
 	return 0;
 }
 
-static int _str_realloc(
-		struct str *s, int new_size)
+static inline int str_reserve(
+		struct str *s, size_t size)
 {
-	while (s->size < new_size){
-		// do realloc
-		void *p = realloc(s->str, s->size + BUFSIZ);
-		if (!p)
+	size_t new_size = s->size ? s->size : BUFSIZ;
+	void *p;
+
+	if (s->size >= size)
+		return 0;
+
+	while (new_size < size){
+		if (new_size > (size_t)-1 / 2)
 			return -1;
-		s->str = (char*)p;
-		s->size += BUFSIZ;
+		new_size *= 2;
 	}
+	
+	// do realloc
+	p = realloc(s->str, new_size);
+	if (!p)
+		return -1;
+	s->str  = (char*)p;
+	s->size = new_size;
+	return 0;
+}
+
+static inline int str_shrink(struct str *s)
+{
+	void *p;
+	if (s->size == s->len + 1)
+		return 0;
+	p = realloc(s->str, s->len + 1);
+	if (!p)
+		return -1;
+	s->str  = (char*)p;
+	s->size = s->len + 1;
 	return 0;
 }
 
-void str_append(
-		struct str *s, const char *str, int len)
+static inline int str_append(
+		struct str *s, const char *str, size_t len)
 {
 	if (!str || len < 1)
-		return;
+		return 0;
 
-	int new_size, i;
-	
-	new_size = s->len + len + 1;
 	// realloc if not enough size
-	if (_str_realloc(s, new_size))
-		return;
+	if (str_reserve(s, s->len + len + 1))
+		return -1;
 
 	// append string
-	for (i = 0; i < len; ++i)
-		s->str[s->len++] = str[i];
-  
+	memcpy(s->str + s->len, str, len);
+	s->len += len;
 	s->str[s->len] = 0;
+	return 0;
+}
+
+static inline int _str_appendf(
+		struct str *s, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+	
+	// get length of formated string
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (len < 0)
+		return -1;
+
+	if (str_reserve(s, s->len + len + 1))
+		return -1;
+	
+	va_start(args, fmt);
+	vsnprintf(s->str + s->len, len + 1, fmt, args);
+	va_end(args);
+	s->len += len;
+	return 0;
 }
 
 #undef  str_appendf
-#define str_appendf(s, ...)\
-	({\
-	 char str[BUFSIZ];\
-	 snprintf(str, BUFSIZ-1, __VA_ARGS__);\
-	 str[BUFSIZ-1] = 0;\
-	 str_append(s, str, strlen(str));\
-	 })
+#define str_appendf(s, ...) _str_appendf(s, __VA_ARGS__)
 
 #endif /* ifndef STR_H_ */
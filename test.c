@@ -40,9 +40,16 @@ int font_cb(void *d, FONT *f)
 
 int char_cb(void *d, STREAM s, prop_t *p, int ch)
 {
-	putchar(ch);
-	char c = ch;
-	str_append(&str, &c, 1);
+	if (ch == PAR)
+		putchar('\n');
+	return 0;
+}
+
+int text_cb(void *d, STREAM s, const prop_t *p, 
+		const char *utf8, size_t len)
+{
+	fwrite(utf8, 1, len, stdout);
+	str_append(&str, utf8, len);
 	return 0;
 }
 
@@ -72,7 +79,7 @@ int main(int argc, char *argv[])
 	n.font_cb = font_cb;
 	n.char_cb = char_cb;
 	n.style_cb = style_cb;
-	n.char_cb = char_cb;
+	n.text_cb = text_cb;
 	n.pict_cb = pict_cb;
 	n.info_cb = info_cb;
 	n.date_cb = date_cb;